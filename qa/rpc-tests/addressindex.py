@@ -105,6 +105,25 @@ class AddressIndexTest(BitcoinTestFramework):
         assert_equal(multitxids[4], txid2)
         assert_equal(multitxids[5], txidb2)
 
+        # Check that txids can be paged through
+        print("Testing paging of txids and deltas...")
+        pages = []
+        page = self.nodes[1].getaddresstxids({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB", "yMNJePdcKvXtWWQnFYHNeJ5u8TF2v1dfK4"], "limit": 4})
+        pages.append(page["txids"])
+        while "cursor" in page:
+            page = self.nodes[1].getaddresstxids({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB", "yMNJePdcKvXtWWQnFYHNeJ5u8TF2v1dfK4"], "limit": 4, "cursor": page["cursor"]})
+            pages.append(page["txids"])
+        assert_equal(pages, [[txidb0, txidb1, txidb2, txid0], [txid1, txid2]])
+
+        deltas = self.nodes[1].getaddressdeltas({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB"]})
+        page = self.nodes[1].getaddressdeltas({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB"], "limit": 2})
+        paged = page["deltas"]
+        while "cursor" in page:
+            page = self.nodes[1].getaddressdeltas({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB"], "limit": 2, "cursor": page["cursor"]})
+            paged += page["deltas"]
+        assert_equal(paged, deltas)
+        assert_raises(JSONRPCException, self.nodes[1].getaddressdeltas, {"addresses": ["yMNJePdcKvXtWWQnFYHNeJ5u8TF2v1dfK4"], "limit": 2, "cursor": "00"})
+
         # Check that balances are correct
         balance0 = self.nodes[1].getaddressbalance("93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB")
         assert_equal(balance0["balance"], 45 * 100000000)
@@ -27,6 +27,7 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - getdbstats
         - verifychain
 
     """
@@ -44,6 +45,7 @@ class BlockchainTest(BitcoinTestFramework):
     def run_test(self):
         self._test_gettxoutsetinfo()
         self._test_getblockheader()
+        self._test_getdbstats()
         self.nodes[0].verifychain(4, 0)
 
     def _test_gettxoutsetinfo(self):
@@ -109,5 +111,18 @@ class BlockchainTest(BitcoinTestFramework):
         assert isinstance(int(header['versionHex'], 16), int)
         assert isinstance(header['difficulty'], Decimal)
 
+    def _test_getdbstats(self):
+        node = self.nodes[0]
+        res = node.getdbstats()
+
+        assert_equal(res['chainstate']['options'], 'compression=0,maxopenfiles=64,bloombits=10,blockcache=50,blocksize=4096')
+        assert_equal(res['index']['options'], 'compression=0,maxopenfiles=64,bloombits=10,blockcache=50,blocksize=4096')
+        for db in ('chainstate', 'index'):
+            assert_equal(len(res[db]['files_per_level']), 7)
+            assert res[db]['memory_usage'] > 0
+            assert 'Compactions' in res[db]['stats']
+        # Only reported with -addressindex, -spentindex or -timestampindex
+        assert 'indexes' not in res
+
 if __name__ == '__main__':
     BlockchainTest().main()
@@ -41,6 +41,12 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
         templat2 = self.nodes[0].getblocktemplate()
         assert(templat2['longpollid'] == longpollid)
 
+        # the template is kept and reported by getmininginfo
+        mininginfo = self.nodes[0].getmininginfo()
+        assert(mininginfo['templateage'] >= 0)
+        assert(mininginfo['templatebuildtime'] >= 0)
+        assert_equal(self.nodes[1].getmininginfo()['templateage'], -1)
+
         # Test 1: test that the longpolling wait if we do nothing
         thr = LongpollThread(self.nodes[0])
         thr.start()
@@ -100,3 +100,13 @@ bool benchmark::State::KeepRunning()
 
     return false;
 }
+
+double benchmark::State::AverageTime() const
+{
+    return count ? (lastTime - beginTime) / count : 0;
+}
+
+void benchmark::State::Report(const std::string& label, double value) const
+{
+    std::cout << std::fixed << std::setprecision(3) << "#" << name << "," << label << "," << value << "\n";
+}
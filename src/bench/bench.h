@@ -57,6 +57,10 @@ namespace benchmark {
             countMaskInv = 1./(countMask + 1);
         }
         bool KeepRunning();
+        //! Average time per iteration once KeepRunning() has returned false
+        double AverageTime() const;
+        //! Print a figure other than the timings, e.g. memory use, for this benchmark
+        void Report(const std::string& label, double value) const;
     };
 
     typedef boost::function<void(State&)> BenchFunction;
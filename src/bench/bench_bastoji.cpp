@@ -11,6 +11,7 @@
 int
 main(int argc, char** argv)
 {
+    Lyra2SpongeAutoDetect();
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
@@ -3,8 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bench.h"
+#include "arith_uint256.h"
 #include "coins.h"
 #include "policy/policy.h"
+#include "random.h"
+#include "script/standard.h"
 #include "wallet/crypter.h"
 
 #include <vector>
@@ -84,4 +87,38 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Random lookups in a cache the size of a busy mempool's working set. The
+// average time per iteration covers LOOKUPS_PER_ITERATION lookups; the run
+// also reports lookups per second and the cache memory used per coin.
+static const int CACHED_COINS = 200000;
+static const int LOOKUPS_PER_ITERATION = 1000;
+
+static void CCoinsCachingLookup(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+
+    std::vector<COutPoint> vOutpoints;
+    vOutpoints.reserve(CACHED_COINS);
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1))));
+    for (int i = 0; i < CACHED_COINS; i++) {
+        vOutpoints.push_back(COutPoint(ArithToUint256(arith_uint256(i / 2 + 1) << 64), i % 2));
+        coins.AddCoin(vOutpoints.back(), Coin(CTxOut(i + 1, scriptPubKey), 1, false), false);
+    }
+    assert(coins.GetCacheSize() == CACHED_COINS);
+
+    FastRandomContext insecure_rand(true);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < LOOKUPS_PER_ITERATION; i++) {
+            const Coin& coin = coins.AccessCoin(vOutpoints[insecure_rand.rand32(CACHED_COINS)]);
+            assert(!coin.IsSpent());
+        }
+    }
+
+    if (state.AverageTime() > 0)
+        state.Report("lookups_per_second", LOOKUPS_PER_ITERATION / state.AverageTime());
+    state.Report("bytes_per_coin", (double)coins.DynamicMemoryUsage() / coins.GetCacheSize());
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsCachingLookup);
@@ -6,6 +6,7 @@
 #include "util.h"
 #include "validation.h"
 #include "checkqueue.h"
+#include "crypto/sha256.h"
 #include "prevector.h"
 #include <vector>
 #include <boost/thread/thread.hpp>
@@ -99,5 +100,55 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// This Benchmark shows how the CheckQueue scales with the number of threads
+// (the master included) for checks that each take about a microsecond, in
+// batches the size of the transactions of a block.
+static const size_t SCALING_BATCHES = 500;
+static const size_t SCALING_BATCH_SIZE = 4;
+static void CCheckQueueScaling(benchmark::State& state, int nThreads)
+{
+    struct HashJob {
+        unsigned char data[64];
+        bool operator()()
+        {
+            for (int i = 0; i < 8; i++)
+                CSHA256().Write(data, sizeof(data)).Finalize(data);
+            return true;
+        }
+        void swap(HashJob& x){std::swap(data, x.data);};
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        std::vector<HashJob> vChecks(SCALING_BATCH_SIZE);
+        for (size_t i = 0; i < SCALING_BATCHES; i++) {
+            for (auto& check : vChecks)
+                memset(check.data, i, sizeof(check.data));
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling_01(benchmark::State& state) { CCheckQueueScaling(state, 1); }
+static void CCheckQueueScaling_02(benchmark::State& state) { CCheckQueueScaling(state, 2); }
+static void CCheckQueueScaling_04(benchmark::State& state) { CCheckQueueScaling(state, 4); }
+static void CCheckQueueScaling_08(benchmark::State& state) { CCheckQueueScaling(state, 8); }
+static void CCheckQueueScaling_16(benchmark::State& state) { CCheckQueueScaling(state, 16); }
+static void CCheckQueueScaling_32(benchmark::State& state) { CCheckQueueScaling(state, 32); }
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueScaling_01);
+BENCHMARK(CCheckQueueScaling_02);
+BENCHMARK(CCheckQueueScaling_04);
+BENCHMARK(CCheckQueueScaling_08);
+BENCHMARK(CCheckQueueScaling_16);
+BENCHMARK(CCheckQueueScaling_32);
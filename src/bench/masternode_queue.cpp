@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "masternode-sync.h"
+#include "masternodeman.h"
+#include "net.h"
+#include "script/standard.h"
+#include "validation.h"
+
+#include <vector>
+
+static const int MASTERNODE_COUNT = 5000;
+static const int CHAIN_HEIGHT = 6000;
+
+// Payment queue lookup (done for every block and every getblocktemplate call)
+// on a network of MASTERNODE_COUNT enabled masternodes with confirmed collaterals.
+static void MasternodePaymentQueue(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+
+    // A chain long enough for every collateral to have MASTERNODE_COUNT confirmations
+    std::vector<uint256> vHashes(CHAIN_HEIGHT + 1);
+    std::vector<CBlockIndex> vBlocks(CHAIN_HEIGHT + 1);
+    for (int i = 0; i <= CHAIN_HEIGHT; i++) {
+        vHashes[i] = ArithToUint256(arith_uint256(i + 1));
+        vBlocks[i].nHeight = i;
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+    }
+
+    CCoinsView viewDummy;
+    CCoinsViewCache viewCoins(&viewDummy);
+    CCoinsViewCache* pcoinsTipOld = pcoinsTip;
+
+    CMasternodeMan mnman;
+    for (int i = 0; i < MASTERNODE_COUNT; i++) {
+        uint256 hash = ArithToUint256(arith_uint256(i + 1) << 128);
+        std::vector<unsigned char> vchPubKey(1, 0x02);
+        vchPubKey.insert(vchPubKey.end(), hash.begin(), hash.end());
+        CPubKey pubKey(vchPubKey);
+        COutPoint outpoint(hash, 0);
+
+        CMasternode mn(CService(), outpoint, pubKey, pubKey, PROTOCOL_VERSION);
+        mn.sigTime = 0;
+        mn.nBlockLastPaid = i % (CHAIN_HEIGHT / 2);
+        mnman.Add(mn);
+
+        viewCoins.AddCoin(outpoint, Coin(CTxOut(1000 * COIN, GetScriptForDestination(pubKey.GetID())), 1, false), false);
+    }
+
+    CConnman connman(0x1337, 0x1337);
+    {
+        LOCK(cs_main);
+        pcoinsTip = &viewCoins;
+        chainActive.SetTip(&vBlocks.back());
+    }
+    // INITIAL -> WAITING -> LIST -> MNW -> GOVERNANCE, winners list is synced from here
+    for (int i = 0; i < 4; i++) {
+        masternodeSync.SwitchToNextAsset(connman);
+    }
+    assert(masternodeSync.IsWinnersListSynced());
+
+    int nCount;
+    masternode_info_t mnInfo;
+    while (state.KeepRunning()) {
+        bool fFound = mnman.GetNextMasternodeInQueueForPayment(CHAIN_HEIGHT + 1, true, nCount, mnInfo);
+        assert(fFound);
+        assert(nCount == MASTERNODE_COUNT);
+    }
+
+    masternodeSync.Reset();
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+        pcoinsTip = pcoinsTipOld;
+    }
+}
+
+BENCHMARK(MasternodePaymentQueue);
@@ -0,0 +1,135 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "netmessagemaker.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include "bench/data/block813851.raw.h"
+
+#include <boost/filesystem.hpp>
+
+// Serving a block (getdata, getblock, rest) reads it back from blk*.dat.
+// Blocks found through the block index only check the record marker in front
+// of the block; other positions also re-check the header's proof of work.
+// A block message for a peer doesn't need the CBlock at all, it can be sent
+// with the bytes as they are stored.
+
+/** Writes a block with the transactions of block813851 to a scratch data directory. */
+class BlockOnDisk
+{
+public:
+    boost::filesystem::path pathTemp;
+    CBlock block;
+    CDiskBlockPos pos;
+    uint256 hash;
+
+    BlockOnDisk()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        const CChainParams& chainparams = Params();
+
+        ClearDatadirCache();
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_bastoji_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        ForceSetArg("-datadir", pathTemp.string());
+
+        CDataStream stream((const char*)raw_bench::block813851,
+                (const char*)&raw_bench::block813851[sizeof(raw_bench::block813851)],
+                SER_NETWORK, PROTOCOL_VERSION);
+        stream >> block;
+
+        // Give it a valid (regtest) proof of work and no parent so it can
+        // stand in for the genesis entry of a block index
+        block.hashPrevBlock.SetNull();
+        block.nBits = UintToArith256(chainparams.GetConsensus().powLimit).GetCompact();
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus()))
+            ++block.nNonce;
+        hash = block.GetHash();
+
+        pos = CDiskBlockPos(0, 0);
+        assert(WriteBlockToDisk(block, pos, chainparams.MessageStart()));
+    }
+
+    ~BlockOnDisk()
+    {
+        boost::filesystem::remove_all(pathTemp);
+    }
+
+    /** An index entry for the block, as the block index would have it */
+    CBlockIndex MakeIndex() const
+    {
+        CBlockIndex index(block);
+        index.phashBlock = &hash;
+        index.nFile = pos.nFile;
+        index.nDataPos = pos.nPos;
+        index.nStatus |= BLOCK_HAVE_DATA;
+        return index;
+    }
+};
+
+static void ReadBlockFromDiskUntrusted(benchmark::State& state)
+{
+    BlockOnDisk disk;
+    const Consensus::Params& params = Params().GetConsensus();
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        assert(ReadBlockFromDisk(block, disk.pos, params));
+    }
+}
+
+static void ReadBlockFromDiskIndexed(benchmark::State& state)
+{
+    BlockOnDisk disk;
+    const Consensus::Params& params = Params().GetConsensus();
+
+    CBlockIndex index = disk.MakeIndex();
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        assert(ReadBlockFromDisk(block, &index, params));
+    }
+}
+
+static void ServeBlockFromDisk(benchmark::State& state)
+{
+    BlockOnDisk disk;
+    const Consensus::Params& params = Params().GetConsensus();
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CBlockIndex index = disk.MakeIndex();
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        assert(ReadBlockFromDisk(block, &index, params));
+        CSerializedNetMsg msg = msgMaker.Make(NetMsgType::BLOCK, block);
+        assert(!msg.data.empty());
+    }
+}
+
+static void ServeRawBlockFromDisk(benchmark::State& state)
+{
+    BlockOnDisk disk;
+    CBlockIndex index = disk.MakeIndex();
+
+    while (state.KeepRunning()) {
+        CSerializedNetMsg msg;
+        msg.command = NetMsgType::BLOCK;
+        assert(ReadRawBlockFromDisk(msg.data, &index));
+    }
+}
+
+BENCHMARK(ReadBlockFromDiskUntrusted);
+BENCHMARK(ReadBlockFromDiskIndexed);
+BENCHMARK(ServeBlockFromDisk);
+BENCHMARK(ServeRawBlockFromDisk);
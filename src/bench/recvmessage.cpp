@@ -0,0 +1,71 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "net.h"
+#include "netmessagemaker.h"
+#include "primitives/transaction.h"
+#include "protocol.h"
+#include "streams.h"
+
+#include <memory>
+
+static const int MESSAGES_PER_ITERATION = 100;
+/** Bytes handed to ReceiveMsgBytes() per call, what one recv() of the socket handler takes at most */
+static const size_t RECV_CHUNK_SIZE = 0x10000;
+
+/** A typical relayed transaction, one P2PKH input and two P2PKH outputs */
+static CTransactionRef MakeRelayTransaction(int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(n + 1)), 0);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    tx.vout.resize(2);
+    for (CTxOut& txout : tx.vout) {
+        txout.nValue = 50000;
+        txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, n) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return MakeTransactionRef(std::move(tx));
+}
+
+// A peer flooding us with tx messages: the cost of receiving them, up to
+// where the message handler takes them. That their data buffers are reused
+// is checked in net_tests.
+static void RecvTxFlood(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+
+    // The bytes on the wire, as CConnman::PushMessage() puts them there
+    std::vector<unsigned char> vWire;
+    for (int i = 0; i < MESSAGES_PER_ITERATION; i++) {
+        CSerializedNetMsg msg = msgMaker.Make(NetMsgType::TX, MakeRelayTransaction(i));
+        uint256 hash = Hash(msg.data.begin(), msg.data.end());
+        CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+        memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+        CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vWire, vWire.size(), hdr};
+        vWire.insert(vWire.end(), msg.data.begin(), msg.data.end());
+    }
+
+    CAddress addr(CService(CNetAddr(), 0), NODE_NONE);
+
+    while (state.KeepRunning()) {
+        // The messages are dropped with the peer, the way they would be
+        // dropped after processing them
+        std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+        bool fComplete = false;
+        for (size_t nPos = 0; nPos < vWire.size(); nPos += RECV_CHUNK_SIZE) {
+            size_t nChunk = std::min(RECV_CHUNK_SIZE, vWire.size() - nPos);
+            assert(pnode->ReceiveMsgBytes((const char*)&vWire[nPos], nChunk, fComplete));
+        }
+        assert(fComplete);
+    }
+}
+
+BENCHMARK(RecvTxFlood);
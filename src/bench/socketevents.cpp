@@ -0,0 +1,148 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "compat.h"
+#include "netbase.h"
+#include "socketevents.h"
+#include "util.h"
+
+#include <string.h>
+#include <vector>
+
+// select() cannot watch file descriptors above FD_SETSIZE, which caps its
+// runs at a few hundred connections; epoll also runs with thousands.
+static const int SELECT_CONNECTIONS = 400;
+static const int EPOLL_CONNECTIONS = 4000;
+
+namespace {
+
+/** Loopback TCP connections, whose server ends are what the socket handler watches */
+class CLoopbackConnections
+{
+public:
+    std::vector<SOCKET> vServer;
+    std::vector<SOCKET> vClient;
+
+    explicit CLoopbackConnections(int nConnections)
+    {
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (hListen == INVALID_SOCKET)
+            return;
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(hListen, SOMAXCONN) != 0 ||
+            getsockname(hListen, (struct sockaddr*)&addr, &len) != 0) {
+            CloseSocket(hListen);
+            return;
+        }
+        for (int i = 0; i < nConnections; i++) {
+            SOCKET hClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (hClient == INVALID_SOCKET)
+                break;
+            if (connect(hClient, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+                CloseSocket(hClient);
+                break;
+            }
+            SOCKET hServer = accept(hListen, NULL, NULL);
+            if (hServer == INVALID_SOCKET) {
+                CloseSocket(hClient);
+                break;
+            }
+            SetSocketNonBlocking(hServer, true);
+            vClient.push_back(hClient);
+            vServer.push_back(hServer);
+        }
+        CloseSocket(hListen);
+    }
+
+    ~CLoopbackConnections()
+    {
+        for (SOCKET& hSocket : vServer)
+            CloseSocket(hSocket);
+        for (SOCKET& hSocket : vClient)
+            CloseSocket(hSocket);
+    }
+};
+
+} // namespace
+
+// One message from one peer out of nConnections mostly idle ones: the time it
+// takes the socket handler to notice it and read it.
+static void SocketEventsRecv(benchmark::State& state, SocketEventsMode mode, int nConnections)
+{
+    SetupNetworking();
+    RaiseFileDescriptorLimit(2 * nConnections + 64);
+    CLoopbackConnections connections(nConnections);
+    if (connections.vServer.empty())
+        return;
+
+    CSocketEvents events(mode);
+    std::vector<size_t> vIndex(connections.vServer.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vIndex[i] = i;
+        events.Add(connections.vServer[i], &vIndex[i], true);
+    }
+
+    // Edge triggered sockets report being writable once after registration
+    std::vector<SocketEvent> vEvents;
+    do {
+        vEvents.clear();
+        events.Wait(0, vEvents);
+    } while (!vEvents.empty());
+
+    size_t nNext = 0;
+    char ch = 0;
+    while (state.KeepRunning()) {
+        // Spread the traffic over all peers
+        size_t nPeer = (nNext++ * 7919) % vIndex.size();
+        send(connections.vClient[nPeer], &ch, 1, MSG_NOSIGNAL);
+
+        bool fReceived = false;
+        while (!fReceived) {
+            if (mode == SOCKETEVENTS_SELECT) {
+                for (size_t i = 0; i < vIndex.size(); i++)
+                    events.Watch(connections.vServer[i], &vIndex[i], true, false);
+            }
+            vEvents.clear();
+            events.Wait(1000, vEvents);
+            for (const SocketEvent& event : vEvents) {
+                if (!event.fRecv)
+                    continue;
+                size_t i = *static_cast<size_t*>(event.pData);
+                char pchBuf[16];
+                while (recv(connections.vServer[i], pchBuf, sizeof(pchBuf), MSG_DONTWAIT) > 0) {
+                    if (i == nPeer)
+                        fReceived = true;
+                }
+            }
+        }
+    }
+}
+
+static void SocketEventsSelect(benchmark::State& state)
+{
+    SocketEventsRecv(state, SOCKETEVENTS_SELECT, SELECT_CONNECTIONS);
+}
+
+BENCHMARK(SocketEventsSelect);
+
+#ifdef HAVE_SYS_EPOLL_H
+static void SocketEventsEpoll(benchmark::State& state)
+{
+    SocketEventsRecv(state, SOCKETEVENTS_EPOLL, SELECT_CONNECTIONS);
+}
+
+static void SocketEventsEpollThousands(benchmark::State& state)
+{
+    SocketEventsRecv(state, SOCKETEVENTS_EPOLL, EPOLL_CONNECTIONS);
+}
+
+BENCHMARK(SocketEventsEpoll);
+BENCHMARK(SocketEventsEpollThousands);
+#endif
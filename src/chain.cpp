@@ -5,6 +5,29 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+
+/**
+ * CBlockIndexArena implementation
+ */
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vSlabs.size(); i++) {
+        size_t nUsed = i + 1 == vSlabs.size() ? nUsedInSlab : SLAB_SIZE;
+        for (size_t j = 0; j < nUsed; j++) {
+            vSlabs[i][j].~CBlockIndex();
+        }
+        ::operator delete(vSlabs[i]);
+    }
+    vSlabs.clear();
+    nUsedInSlab = SLAB_SIZE;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const
+{
+    return vSlabs.size() * memusage::MallocUsage(SLAB_SIZE * sizeof(CBlockIndex)) + memusage::DynamicUsage(vSlabs);
+}
+
 /**
  * CChain implementation
  */
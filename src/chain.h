@@ -12,6 +12,9 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <algorithm>
+#include <new>
+#include <utility>
 #include <vector>
 
 class CBlockFileInfo
@@ -419,6 +422,71 @@ public:
     }
 };
 
+/**
+ * Storage for the CBlockIndex entries of mapBlockIndex.
+ *
+ * Entries are placed one after another in slabs of SLAB_SIZE objects instead
+ * of one heap allocation each. The block index is loaded in height order and
+ * new headers mostly arrive in that order too, so the entries of the active
+ * chain end up next to each other and walking pprev mostly stays within the
+ * same pages. Entries are never freed on their own, only all at once.
+ */
+class CBlockIndexArena
+{
+public:
+    static const size_t SLAB_SIZE = 4096;
+
+    CBlockIndexArena() : nUsedInSlab(SLAB_SIZE) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndexArena(const CBlockIndexArena&) = delete;
+    CBlockIndexArena& operator=(const CBlockIndexArena&) = delete;
+
+    template <typename... Args>
+    CBlockIndex* New(Args&&... args)
+    {
+        if (nUsedInSlab == SLAB_SIZE) {
+            vSlabs.push_back(static_cast<CBlockIndex*>(::operator new(SLAB_SIZE * sizeof(CBlockIndex))));
+            nUsedInSlab = 0;
+        }
+        CBlockIndex* pindex = new (vSlabs.back() + nUsedInSlab) CBlockIndex(std::forward<Args>(args)...);
+        nUsedInSlab++;
+        return pindex;
+    }
+
+    /** Destroy all entries. Every pointer handed out becomes invalid. */
+    void Clear();
+
+    size_t Size() const { return vSlabs.empty() ? 0 : (vSlabs.size() - 1) * SLAB_SIZE + nUsedInSlab; }
+    size_t DynamicMemoryUsage() const;
+
+private:
+    std::vector<CBlockIndex*> vSlabs;
+    //! Entries used in the last slab
+    size_t nUsedInSlab;
+};
+
+/**
+ * Order block index items by height with a counting sort, as the heights are
+ * dense. Items of the same height keep their relative order.
+ */
+template <typename T, typename HeightOf>
+std::vector<T> SortByHeight(const std::vector<T>& vItems, HeightOf heightOf)
+{
+    int nMaxHeight = 0;
+    for (const T& item : vItems)
+        nMaxHeight = std::max(nMaxHeight, heightOf(item));
+    std::vector<size_t> vHeightPos(nMaxHeight + 2, 0);
+    for (const T& item : vItems)
+        vHeightPos[heightOf(item) + 1]++;
+    for (int nHeight = 1; nHeight <= nMaxHeight; nHeight++)
+        vHeightPos[nHeight] += vHeightPos[nHeight - 1];
+    std::vector<T> vSorted(vItems.size());
+    for (const T& item : vItems)
+        vSorted[vHeightPos[heightOf(item)]++] = item;
+    return vSorted;
+}
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
@@ -677,12 +677,12 @@ public:
 		nDefaultPort = 19994;
 		nPruneAfterHeight = 1000;
 
-		genesis = CreateGenesisBlock(1417713337, 1096447, 0x207fffff, 1,
+		genesis = CreateGenesisBlock(1417713337, 1096448, 0x207fffff, 1,
 				50 * COIN);
 		consensus.hashGenesisBlock = genesis.GetHash();
 		//  std::cout << "regtest genesis is : " << genesis.GetHash().ToString() << " \n";
 
-		//  assert(consensus.hashGenesisBlock == uint256S("0x000008ca1832a4baf228eb1553c03d3a2c8e02399550dd6ea8d65cec3ef23d2e"));
+		//  assert(consensus.hashGenesisBlock == uint256S("0x36e49e53ddaa788852ab66239b8dbcda1d2517dc08bf483bacfa290e4b60845c"));
 		//  assert(genesis.hashMerkleRoot == uint256S("0xe0028eb9648db56b1ac77cf090b99048a8007e2bb64b68f092c03c7f56a662c7"));
 
 		vFixedSeeds.clear(); //!< Regtest mode doesn't have any fixed seeds.
@@ -704,7 +704,7 @@ public:
 				(CCheckpointData ) {
 								boost::assign::map_list_of(0,
 										uint256S(
-												"0x000008ca1832a4baf228eb1553c03d3a2c8e02399550dd6ea8d65cec3ef23d2e")) };
+												"0x36e49e53ddaa788852ab66239b8dbcda1d2517dc08bf483bacfa290e4b60845c")) };
 
 		chainTxData = ChainTxData { 0, 0, 0 };
 
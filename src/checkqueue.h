@@ -6,124 +6,316 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <stdint.h>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
 
-/** 
- * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
-template <typename T>
-class CCheckQueue
+/**
+ * Work-stealing deque of ranges of check indexes (Chase-Lev, in the C11
+ * formulation of Le et al., "Correct and Efficient Work-Stealing for Weak
+ * Memory Models"). Only the owner pushes and takes at the bottom; any thread
+ * may steal from the top. No operation takes a lock.
+ *
+ * A range [begin, end) is packed into one 64 bit value, so slots can be
+ * plain atomics. The ring grows when full; old rings are kept until the deque
+ * is destroyed, since a thief may still be reading from one.
+ */
+class CCheckRangeDeque
 {
+public:
+    static const uint64_t EMPTY = 0;
+
+    static uint64_t MakeRange(uint32_t nBegin, uint32_t nEnd) { return ((uint64_t)nBegin << 32) | nEnd; }
+    static uint32_t RangeBegin(uint64_t range) { return range >> 32; }
+    static uint32_t RangeEnd(uint64_t range) { return (uint32_t)range; }
+
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    struct Ring {
+        const int64_t nSize;
+        std::atomic<uint64_t>* const slots;
+        explicit Ring(int64_t nSizeIn) : nSize(nSizeIn), slots(new std::atomic<uint64_t>[nSizeIn]) {}
+        ~Ring() { delete[] slots; }
+        uint64_t Get(int64_t i) const { return slots[i & (nSize - 1)].load(std::memory_order_relaxed); }
+        void Put(int64_t i, uint64_t x) { slots[i & (nSize - 1)].store(x, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> nTop;
+    std::atomic<int64_t> nBottom;
+    std::atomic<Ring*> pring;
+    //! All rings ever used, owned by the deque
+    std::vector<Ring*> vRings;
+
+public:
+    CCheckRangeDeque() : nTop(0), nBottom(0)
+    {
+        vRings.push_back(new Ring(64));
+        pring.store(vRings.back(), std::memory_order_relaxed);
+    }
+
+    ~CCheckRangeDeque()
+    {
+        for (Ring* ring : vRings)
+            delete ring;
+    }
+
+    CCheckRangeDeque(const CCheckRangeDeque&) = delete;
+    CCheckRangeDeque& operator=(const CCheckRangeDeque&) = delete;
+
+    //! Owner only
+    void Push(uint64_t range)
+    {
+        int64_t b = nBottom.load(std::memory_order_relaxed);
+        int64_t t = nTop.load(std::memory_order_acquire);
+        Ring* ring = pring.load(std::memory_order_relaxed);
+        if (b - t > ring->nSize - 1) {
+            Ring* ringNew = new Ring(ring->nSize * 2);
+            for (int64_t i = t; i < b; i++)
+                ringNew->Put(i, ring->Get(i));
+            vRings.push_back(ringNew);
+            pring.store(ringNew, std::memory_order_release);
+            ring = ringNew;
+        }
+        ring->Put(b, range);
+        nBottom.store(b + 1, std::memory_order_release);
+    }
 
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    //! Owner only; returns EMPTY if there is nothing left
+    uint64_t Take()
+    {
+        int64_t b = nBottom.load(std::memory_order_relaxed) - 1;
+        Ring* ring = pring.load(std::memory_order_relaxed);
+        nBottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = nTop.load(std::memory_order_relaxed);
+        if (t > b) {
+            nBottom.store(b + 1, std::memory_order_relaxed);
+            return EMPTY;
+        }
+        uint64_t range = ring->Get(b);
+        if (t == b) {
+            // Last element, race against thieves for it
+            if (!nTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                range = EMPTY;
+            nBottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return range;
+    }
 
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    //! Any thread; returns EMPTY if there is nothing to steal or another thread won the race
+    uint64_t Steal()
+    {
+        int64_t t = nTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = nBottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return EMPTY;
+        Ring* ring = pring.load(std::memory_order_acquire);
+        uint64_t range = ring->Get(t);
+        if (!nTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return EMPTY;
+        return range;
+    }
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    bool IsEmpty() const
+    {
+        return nTop.load(std::memory_order_seq_cst) >= nBottom.load(std::memory_order_seq_cst);
+    }
+};
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+/**
+ * Queue for verifications that have to be performed.
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Scheduling is work stealing. The checks are stored in chunks owned by the
+ * queue and handed around as index ranges of at most nBatchSize checks. The
+ * master pushes the ranges onto its own deque, every worker has a deque of
+ * its own, and a thread out of work steals from a random other deque. A
+ * thread that has a range while others are idle splits it and keeps pushing
+ * the upper half onto its deque for them to steal. None of this takes a lock;
+ * the mutex is only used to put idle threads to sleep and wake them up.
+ */
+template <typename T>
+class CCheckQueue
+{
+private:
+    //! Checks per storage chunk
+    static const uint32_t CHUNK_SIZE = 1024;
+    //! Max chunks, i.e. max checks per round of CHUNK_SIZE * MAX_CHUNKS
+    static const uint32_t MAX_CHUNKS = 4096;
+    //! Max threads with a deque of their own (the master included); later ones only steal
+    static const int MAX_DEQUES = 64;
+    //! Times an idle thread looks for work before it goes to sleep
+    static const int MAX_IDLE_SPINS = 64;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Storage of the checks of the current round, indexed by check number
+    std::vector<T*> vChunks;
+    //! Checks added in the current round (master only)
+    uint32_t nAdded;
+
+    //! Deque 0 belongs to the master, the others to the worker threads
+    std::vector<CCheckRangeDeque*> vDeques;
+    //! Number of worker threads that registered so far
+    std::atomic<int> nWorkers;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes checks that are no longer queued, but still in a
+     * thread's own range.
      */
-    unsigned int nTodo;
+    std::atomic<int64_t> nTodo;
+
+    //! Threads (the master included) that found no work and are looking or sleeping
+    std::atomic<int> nIdle;
+    //! Threads (the master included) sleeping on cond
+    std::atomic<int> nSleeping;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Only protects sleeping
+    boost::mutex mutex;
+    boost::condition_variable cond;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    T& Check(uint32_t i)
+    {
+        return vChunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+    }
+
+    int NumDeques() const
+    {
+        // not std::min, which would bind MAX_DEQUES by reference and need a definition of it
+        int n = nWorkers.load(std::memory_order_relaxed) + 1;
+        return n < MAX_DEQUES ? n : MAX_DEQUES;
+    }
+
+    bool HasWork() const
+    {
+        int n = NumDeques();
+        for (int i = 0; i < n; i++) {
+            if (!vDeques[i]->IsEmpty())
+                return true;
+        }
+        return false;
+    }
+
+    void WakeSleepers()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (nSleeping.load(std::memory_order_seq_cst) > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+    //! Take a range from the own deque, or steal one
+    uint64_t FindWork(int nDeque, uint32_t& nRand)
+    {
+        if (nDeque >= 0) {
+            uint64_t range = vDeques[nDeque]->Take();
+            if (range != CCheckRangeDeque::EMPTY)
+                return range;
+        }
+        int n = NumDeques();
+        nRand ^= nRand << 13;
+        nRand ^= nRand >> 17;
+        nRand ^= nRand << 5;
+        for (int k = 0; k < n; k++) {
+            int nVictim = (nRand + k) % n;
+            if (nVictim == nDeque)
+                continue;
+            uint64_t range = vDeques[nVictim]->Steal();
+            if (range != CCheckRangeDeque::EMPTY)
+                return range;
+        }
+        return CCheckRangeDeque::EMPTY;
+    }
+
+    //! Run the checks of a range, leaving part of it to idle threads if possible
+    void Execute(int nDeque, uint64_t range)
+    {
+        uint32_t nBegin = CCheckRangeDeque::RangeBegin(range);
+        uint32_t nEnd = CCheckRangeDeque::RangeEnd(range);
+        if (nDeque >= 0 && nEnd - nBegin > 1 && nIdle.load(std::memory_order_relaxed) > 0) {
+            while (nEnd - nBegin > 1) {
+                uint32_t nMid = nBegin + (nEnd - nBegin) / 2;
+                vDeques[nDeque]->Push(CCheckRangeDeque::MakeRange(nMid, nEnd));
+                nEnd = nMid;
+            }
+            WakeSleepers();
+        }
+        for (uint32_t i = nBegin; i < nEnd; i++) {
+            T& check = Check(i);
+            // Check whether we need to do work at all
+            if (fAllOk.load(std::memory_order_relaxed) && !check())
+                fAllOk.store(false, std::memory_order_relaxed);
+            // Release what the check holds before it counts as done
+            T().swap(check);
+        }
+        int64_t nDone = nEnd - nBegin;
+        if (nTodo.fetch_sub(nDone, std::memory_order_acq_rel) == nDone) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
-    {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
+    bool Loop(int nDeque, bool fMaster = false)
+    {
+        uint32_t nRand = 2463534242U + 7919 * (nDeque + 1);
+        int nSpins = 0;
+        bool fIdle = false;
+        while (true) {
+            uint64_t range = FindWork(nDeque, nRand);
+            if (range != CCheckRangeDeque::EMPTY) {
+                if (fIdle) {
                     nIdle--;
+                    fIdle = false;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nSpins = 0;
+                Execute(nDeque, range);
+                continue;
+            }
+            if (fMaster && nTodo.load(std::memory_order_acquire) == 0)
+                break;
+            if (!fIdle) {
+                nIdle++;
+                fIdle = true;
+            }
+            if (++nSpins < MAX_IDLE_SPINS) {
+                boost::this_thread::yield();
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+            nSpins = 0;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSleeping++;
+            if (!HasWork() && !(fMaster && nTodo.load() == 0))
+                cond.wait(lock);
+            nSleeping--;
+        }
+        if (fIdle)
+            nIdle--;
+
+        // reset the status for new work later
+        nAdded = 0;
+        return fAllOk.exchange(true);
     }
 
 public:
@@ -131,42 +323,65 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) :
+        vChunks(MAX_CHUNKS, nullptr), nAdded(0), nWorkers(0), fAllOk(true), nTodo(0), nIdle(0), nSleeping(0),
+        nBatchSize(std::max(1U, nBatchSizeIn))
+    {
+        for (int i = 0; i < MAX_DEQUES; i++)
+            vDeques.push_back(new CCheckRangeDeque());
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        int nDeque = nWorkers.fetch_add(1) + 1;
+        Loop(nDeque < MAX_DEQUES ? nDeque : -1);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        if ((uint64_t)nAdded + vChecks.size() > (uint64_t)CHUNK_SIZE * MAX_CHUNKS) {
+            // Out of storage for this round; run them here
+            for (T& check : vChecks) {
+                if (fAllOk.load(std::memory_order_relaxed) && !check())
+                    fAllOk.store(false, std::memory_order_relaxed);
+                T().swap(check);
+            }
+            return;
+        }
+        uint32_t nBegin = nAdded;
+        for (T& check : vChecks) {
+            if (vChunks[nAdded / CHUNK_SIZE] == nullptr)
+                vChunks[nAdded / CHUNK_SIZE] = new T[CHUNK_SIZE];
+            check.swap(Check(nAdded));
+            nAdded++;
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nTodo.fetch_add(vChecks.size(), std::memory_order_relaxed);
+        for (uint32_t i = nBegin; i < nAdded; i += nBatchSize)
+            vDeques[0]->Push(CCheckRangeDeque::MakeRange(i, std::min(nAdded, i + nBatchSize)));
+        WakeSleepers();
     }
 
     ~CCheckQueue()
     {
+        for (T* chunk : vChunks)
+            delete[] chunk;
+        for (CCheckRangeDeque* deque : vDeques)
+            delete deque;
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
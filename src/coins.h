@@ -11,10 +11,12 @@
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
+#include <memory>
 #include <unordered_map>
 
 /**
@@ -83,7 +85,7 @@ class SaltedOutpointHasher
 {
 private:
     /** Salt */
-    const uint64_t k0, k1;
+    uint64_t k0, k1;
 
 public:
     SaltedOutpointHasher();
@@ -117,7 +119,12 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * Map of cached coins. Nodes are allocated from a PoolResource when the map is
+ * given one (as CCoinsViewCache does), so a flush can drop the whole arena at
+ * once instead of freeing every entry separately.
+ */
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry> > > CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -198,6 +205,8 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Arena holding the nodes of cacheCoins; must outlive it. */
+    mutable std::unique_ptr<PoolResource> pcacheCoinsResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
@@ -223,6 +232,14 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Insert a coin that the caller read from the backing view itself, e.g. to
+     * warm the cache ahead of connecting a block. The coin must be the current,
+     * unspent version in the backing view. Does nothing if the outpoint already
+     * has an entry in this cache.
+     */
+    void CacheBaseCoin(const COutPoint &outpoint, Coin&& coin);
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -290,6 +307,9 @@ public:
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 
+    //! Replace the (empty) cache map and its arena by fresh ones, releasing all node memory at once
+    void ReallocateCache();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -24,6 +24,66 @@
 #include "Lyra2.h"
 #include "Sponge.h"
 
+#if defined(_MSC_VER)
+#define LYRA2_THREAD_LOCAL __declspec(thread)
+#else
+#define LYRA2_THREAD_LOCAL __thread
+#endif
+
+/**
+ * Per-thread memory matrix, large enough for every parameter set used by the
+ * Lyra2RE/Lyra2REv2 hashes (LYRA2_old uses 8x8, LYRA2 uses 4x4). Hashing with
+ * these parameters never touches the heap; larger matrices fall back to malloc.
+ */
+#define LYRA2_WORKSPACE_ROWS 8
+#define LYRA2_WORKSPACE_COLS 8
+
+static LYRA2_THREAD_LOCAL uint64_t lyra2Workspace[LYRA2_WORKSPACE_ROWS * LYRA2_WORKSPACE_COLS * BLOCK_LEN_INT64] ALIGN;
+
+/**
+ * Provides the memory matrix and its row pointers, either from the calling
+ * thread's workspace (rowPtrs must hold LYRA2_WORKSPACE_ROWS entries) or from
+ * the heap.
+ *
+ * @return 0 on success; -1 if a heap allocation failed
+ */
+static int acquireMatrix(uint64_t nRows, uint64_t nCols, uint64_t **wholeMatrix, uint64_t ***memMatrix, uint64_t **rowPtrs) {
+    const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
+    uint64_t *ptrWord;
+    uint64_t i;
+
+    if (nRows <= LYRA2_WORKSPACE_ROWS && nCols <= LYRA2_WORKSPACE_COLS) {
+      *wholeMatrix = lyra2Workspace;
+      *memMatrix = rowPtrs;
+    } else {
+      *wholeMatrix = malloc(nRows * ROW_LEN_INT64 * sizeof (uint64_t));
+      if (*wholeMatrix == NULL) {
+        return -1;
+      }
+      *memMatrix = malloc(nRows * sizeof (uint64_t*));
+      if (*memMatrix == NULL) {
+        free(*wholeMatrix);
+        return -1;
+      }
+    }
+
+    //Places the pointers in the correct positions
+    ptrWord = *wholeMatrix;
+    for (i = 0; i < nRows; i++) {
+      (*memMatrix)[i] = ptrWord;
+      ptrWord += ROW_LEN_INT64;
+    }
+    return 0;
+}
+
+/** Releases a matrix obtained from acquireMatrix. */
+static void releaseMatrix(uint64_t *wholeMatrix, uint64_t **memMatrix) {
+    if (wholeMatrix != lyra2Workspace) {
+      free(memMatrix);
+      free(wholeMatrix);
+    }
+}
+
 /**
  * Executes Lyra2 based on the G function from Blake2b. This version supports salts and passwords
  * whose combined length is smaller than the size of the memory matrix, (i.e., (nRows x nCols x b) bits,
@@ -57,30 +117,22 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     //==========================================================================/
 
     //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
+    //Takes the whole memory matrix from the thread workspace (or the heap if it does not fit)
 
 
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
     const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 
     i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
+    uint64_t *rowPtrs[LYRA2_WORKSPACE_ROWS];
+    uint64_t *wholeMatrix;
+    uint64_t **memMatrix;
+    if (acquireMatrix(nRows, nCols, &wholeMatrix, &memMatrix, rowPtrs) != 0) {
       return -1;
     }
 	memset(wholeMatrix, 0, i);
 
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-      memMatrix[i] = ptrWord;
-      ptrWord += ROW_LEN_INT64;
-    }
+    uint64_t *ptrWord;
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -123,10 +175,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16] ALIGN;
     initState(state);
     //==========================================================================/
 
@@ -201,12 +250,10 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     //==========================================================================/
 
     //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
+    releaseMatrix(wholeMatrix, memMatrix);
 
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
     //==========================================================================/
 
     return 0;
@@ -226,30 +273,22 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
     //==========================================================================/
 
     //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
+    //Takes the whole memory matrix from the thread workspace (or the heap if it does not fit)
 
 
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
     const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 
     i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
+    uint64_t *rowPtrs[LYRA2_WORKSPACE_ROWS];
+    uint64_t *wholeMatrix;
+    uint64_t **memMatrix;
+    if (acquireMatrix(nRows, nCols, &wholeMatrix, &memMatrix, rowPtrs) != 0) {
       return -1;
     }
 	memset(wholeMatrix, 0, i);
 
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-      memMatrix[i] = ptrWord;
-      ptrWord += ROW_LEN_INT64;
-    }
+    uint64_t *ptrWord;
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -292,10 +331,7 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16] ALIGN;
     initState(state);
     //==========================================================================/
 
@@ -370,12 +406,10 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
     //==========================================================================/
 
     //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
+    releaseMatrix(wholeMatrix, memMatrix);
 
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
     //==========================================================================/
 
     return 0;
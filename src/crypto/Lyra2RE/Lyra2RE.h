@@ -8,6 +8,15 @@ extern "C" {
 void lyra2re_hash(const char* input, char* output);
 void lyra2re2_hash(const char* input, char* output);
 
+/** Implementations of the Lyra2 sponge (see Sponge.c) */
+#define LYRA2_SPONGE_GENERIC 0
+#define LYRA2_SPONGE_SSE2    1
+#define LYRA2_SPONGE_AVX2    2
+
+int Lyra2SpongeSetImplementation(int impl);
+int Lyra2SpongeSelfTest(void);
+const char *Lyra2SpongeAutoDetect(void);
+
 #ifdef __cplusplus
 }
 #endif
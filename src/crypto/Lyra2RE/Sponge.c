@@ -23,6 +23,7 @@
 #include <time.h>
 #include "Sponge.h"
 #include "Lyra2.h"
+#include "Lyra2RE.h"
 
 
 
@@ -56,7 +57,7 @@ inline void initState(uint64_t state[/*16*/]) {
  *
  * @param v     A 1024-bit (16 uint64_t) array to be processed by Blake2b's G function
  */
-inline static void blake2bLyra(uint64_t *v) {
+static void blake2bLyra_generic(uint64_t *v) {
     ROUND_LYRA(0);
     ROUND_LYRA(1);
     ROUND_LYRA(2);
@@ -79,6 +80,21 @@ inline static void reducedBlake2bLyra(uint64_t *v) {
     ROUND_LYRA(0);
 }
 
+static void reducedSqueezeRow0_generic(uint64_t* state, uint64_t* rowOut, uint64_t nCols);
+static void reducedDuplexRow1_generic(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols);
+static void reducedDuplexRowSetup_generic(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+static void reducedDuplexRow_generic(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+
+/**
+ * Implementation of the sponge primitives in use, selected by
+ * Lyra2SpongeSetImplementation. Defaults to the portable C code below.
+ */
+static void (*blake2bLyra)(uint64_t *v) = blake2bLyra_generic;
+static void (*reducedSqueezeRow0Impl)(uint64_t* state, uint64_t* rowOut, uint64_t nCols) = reducedSqueezeRow0_generic;
+static void (*reducedDuplexRow1Impl)(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) = reducedDuplexRow1_generic;
+static void (*reducedDuplexRowSetupImpl)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) = reducedDuplexRowSetup_generic;
+static void (*reducedDuplexRowImpl)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) = reducedDuplexRow_generic;
+
 /**
  * Performs a squeeze operation, using Blake2b's G function as the
  * internal permutation
@@ -161,7 +177,7 @@ inline void absorbBlockBlake2Safe(uint64_t *state, const uint64_t *in) {
  * @param state     The current state of the sponge
  * @param rowOut    Row to receive the data squeezed
  */
-inline void reducedSqueezeRow0(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
+static void reducedSqueezeRow0_generic(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
     uint64_t* ptrWord = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to M[0][C-1]
     int i;
     //M[row][C-1-col] = H.reduced_squeeze()
@@ -196,7 +212,7 @@ inline void reducedSqueezeRow0(uint64_t* state, uint64_t* rowOut, uint64_t nCols
  * @param rowIn		Row to feed the sponge
  * @param rowOut	Row to receive the sponge's output
  */
-inline void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
+static void reducedDuplexRow1_generic(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
     uint64_t* ptrWordIn = rowIn;				//In Lyra2: pointer to prev
     uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to row
     int i;
@@ -256,7 +272,7 @@ inline void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut
  * @param rowOut         Row receiving the output
  *
  */
-inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+static void reducedDuplexRowSetup_generic(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
     uint64_t* ptrWordIn = rowIn;				//In Lyra2: pointer to prev
     uint64_t* ptrWordInOut = rowInOut;				//In Lyra2: pointer to row*
     uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to row
@@ -330,7 +346,7 @@ inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *ro
  * @param rowOut         Row receiving the output
  *
  */
-inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+static void reducedDuplexRow_generic(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
     uint64_t* ptrWordInOut = rowInOut; //In Lyra2: pointer to row*
     uint64_t* ptrWordIn = rowIn; //In Lyra2: pointer to prev
     uint64_t* ptrWordOut = rowOut; //In Lyra2: pointer to row
@@ -391,6 +407,160 @@ inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOu
 }
 
 
+void reducedSqueezeRow0(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
+    reducedSqueezeRow0Impl(state, rowOut, nCols);
+}
+
+void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
+    reducedDuplexRow1Impl(state, rowIn, rowOut, nCols);
+}
+
+void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    reducedDuplexRowSetupImpl(state, rowIn, rowInOut, rowOut, nCols);
+}
+
+void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    reducedDuplexRowImpl(state, rowIn, rowInOut, rowOut, nCols);
+}
+
+#ifdef LYRA2_SPONGE_X86
+#include <cpuid.h>
+
+/**
+ * Checks CPUID for AVX2, and XGETBV for the OS saving the YMM registers.
+ */
+static int HaveAVX2(void) {
+    uint32_t eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    //OSXSAVE (bit 27) and AVX (bit 28)
+    if ((ecx & (1u << 27)) == 0 || (ecx & (1u << 28)) == 0) {
+        return 0;
+    }
+    __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    //XMM (bit 1) and YMM (bit 2) state enabled
+    if ((xcr0_lo & 6) != 6) {
+        return 0;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    //AVX2 (leaf 7, EBX bit 5)
+    return (ebx & (1u << 5)) != 0;
+}
+#endif
+
+/**
+ * Selects the implementation of the sponge primitives.
+ *
+ * @param impl  One of LYRA2_SPONGE_GENERIC, LYRA2_SPONGE_SSE2 or LYRA2_SPONGE_AVX2
+ *
+ * @return 1 if the implementation is now in use; 0 if it is not supported by
+ *         this build or CPU, in which case the current selection is kept
+ */
+int Lyra2SpongeSetImplementation(int impl) {
+    switch (impl) {
+    case LYRA2_SPONGE_GENERIC:
+        blake2bLyra = blake2bLyra_generic;
+        reducedSqueezeRow0Impl = reducedSqueezeRow0_generic;
+        reducedDuplexRow1Impl = reducedDuplexRow1_generic;
+        reducedDuplexRowSetupImpl = reducedDuplexRowSetup_generic;
+        reducedDuplexRowImpl = reducedDuplexRow_generic;
+        return 1;
+#ifdef LYRA2_SPONGE_X86
+    case LYRA2_SPONGE_SSE2:
+        blake2bLyra = blake2bLyra_sse2;
+        reducedSqueezeRow0Impl = reducedSqueezeRow0_sse2;
+        reducedDuplexRow1Impl = reducedDuplexRow1_sse2;
+        reducedDuplexRowSetupImpl = reducedDuplexRowSetup_sse2;
+        reducedDuplexRowImpl = reducedDuplexRow_sse2;
+        return 1;
+    case LYRA2_SPONGE_AVX2:
+        if (!HaveAVX2()) {
+            return 0;
+        }
+        blake2bLyra = blake2bLyra_avx2;
+        reducedSqueezeRow0Impl = reducedSqueezeRow0_avx2;
+        reducedDuplexRow1Impl = reducedDuplexRow1_avx2;
+        reducedDuplexRowSetupImpl = reducedDuplexRowSetup_avx2;
+        reducedDuplexRowImpl = reducedDuplexRow_avx2;
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Runs every sponge primitive over a small pseudorandom matrix with both the
+ * portable implementation and the one currently selected, and compares the
+ * resulting states and rows.
+ *
+ * @return 1 if both implementations agree; 0 otherwise
+ */
+int Lyra2SpongeSelfTest(void) {
+    enum { COLS = 4, ROW_LEN = BLOCK_LEN_INT64 * COLS };
+    uint64_t matrix[2][4 * ROW_LEN];
+    uint64_t state[2][16];
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    unsigned int i;
+    int k;
+
+    for (i = 0; i < 4 * ROW_LEN; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        matrix[0][i] = matrix[1][i] = seed;
+    }
+    for (k = 0; k < 2; k++) {
+        uint64_t *m = matrix[k];
+        uint64_t *s = state[k];
+        void (*full)(uint64_t*) = k == 0 ? blake2bLyra_generic : blake2bLyra;
+
+        initState(s);
+        s[0] ^= m[0];
+        full(s);
+        if (k == 0) {
+            reducedSqueezeRow0_generic(s, m, COLS);
+            reducedDuplexRow1_generic(s, m, m + ROW_LEN, COLS);
+            reducedDuplexRowSetup_generic(s, m + ROW_LEN, m, m + 2 * ROW_LEN, COLS);
+            reducedDuplexRow_generic(s, m + 2 * ROW_LEN, m + ROW_LEN, m + 3 * ROW_LEN, COLS);
+            //rowOut and rowInOut may be the same row during the Wandering phase
+            reducedDuplexRow_generic(s, m + 3 * ROW_LEN, m, m, COLS);
+        } else {
+            reducedSqueezeRow0Impl(s, m, COLS);
+            reducedDuplexRow1Impl(s, m, m + ROW_LEN, COLS);
+            reducedDuplexRowSetupImpl(s, m + ROW_LEN, m, m + 2 * ROW_LEN, COLS);
+            reducedDuplexRowImpl(s, m + 2 * ROW_LEN, m + ROW_LEN, m + 3 * ROW_LEN, COLS);
+            reducedDuplexRowImpl(s, m + 3 * ROW_LEN, m, m, COLS);
+        }
+        full(s);
+    }
+    return memcmp(state[0], state[1], sizeof(state[0])) == 0 &&
+           memcmp(matrix[0], matrix[1], sizeof(matrix[0])) == 0;
+}
+
+/**
+ * Picks the fastest sponge implementation supported by the CPU, falling back
+ * to the portable one if the self-test fails. Not thread safe: call once at
+ * startup, before any hashing threads are started.
+ *
+ * @return A short description of the implementation selected
+ */
+const char *Lyra2SpongeAutoDetect(void) {
+#ifdef LYRA2_SPONGE_X86
+    if (Lyra2SpongeSetImplementation(LYRA2_SPONGE_AVX2) && Lyra2SpongeSelfTest()) {
+        return "avx2";
+    }
+    if (Lyra2SpongeSetImplementation(LYRA2_SPONGE_SSE2) && Lyra2SpongeSelfTest()) {
+        return "sse2";
+    }
+#endif
+    Lyra2SpongeSetImplementation(LYRA2_SPONGE_GENERIC);
+    return "standard";
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
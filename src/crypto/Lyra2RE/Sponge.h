@@ -92,6 +92,24 @@ void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint
 //---- Misc
 void printArray(unsigned char *array, unsigned int size, char *name);
 
+//---- Vectorized implementations (selection is declared in Lyra2RE.h)
+//SSE2 is part of x86-64, AVX2 is checked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__))
+#define LYRA2_SPONGE_X86 1
+
+void blake2bLyra_sse2(uint64_t *v);
+void reducedSqueezeRow0_sse2(uint64_t* state, uint64_t* rowOut, uint64_t nCols);
+void reducedDuplexRow1_sse2(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols);
+void reducedDuplexRowSetup_sse2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+void reducedDuplexRow_sse2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+
+void blake2bLyra_avx2(uint64_t *v);
+void reducedSqueezeRow0_avx2(uint64_t* state, uint64_t* rowOut, uint64_t nCols);
+void reducedDuplexRow1_avx2(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols);
+void reducedDuplexRowSetup_avx2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+void reducedDuplexRow_avx2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 
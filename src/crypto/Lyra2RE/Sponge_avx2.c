@@ -0,0 +1,215 @@
+/**
+ * AVX2 implementation of the Blake2b based sponge used by Lyra2.
+ *
+ * Each row of the 4x4 Blake2b state lives in one 256-bit register, so a G
+ * function step processes all four columns (or diagonals) at once. Results
+ * are bit-for-bit identical to Sponge.c. Only called after CPUID reported
+ * AVX2 support (see Lyra2SpongeAutoDetect).
+ *
+ * This software is hereby placed in the public domain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Sponge.h"
+#include "Lyra2.h"
+
+#ifdef LYRA2_SPONGE_X86
+
+#include <immintrin.h>
+
+/*Functions are compiled for AVX2 regardless of the global -march setting*/
+#define AVX2_TARGET __attribute__ ((target("avx2")))
+
+/*Blake2b's rotations; r24 and r16 are byte shuffle masks*/
+#define ROTR32_AVX2(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2,3,0,1))
+#define ROTR24_AVX2(x) _mm256_shuffle_epi8((x), r24)
+#define ROTR16_AVX2(x) _mm256_shuffle_epi8((x), r16)
+#define ROTR63_AVX2(x) _mm256_or_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define DECLARE_ROTR_MASKS_AVX2 \
+    const __m256i r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, \
+                                         3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10); \
+    const __m256i r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, \
+                                         2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9)
+
+/*Blake2b's G function, applied to all four columns at once*/
+#define G_AVX2(a,b,c,d) \
+  do { \
+    a = _mm256_add_epi64(a, b); \
+    d = ROTR32_AVX2(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi64(c, d); \
+    b = ROTR24_AVX2(_mm256_xor_si256(b, c)); \
+    a = _mm256_add_epi64(a, b); \
+    d = ROTR16_AVX2(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi64(c, d); \
+    b = ROTR63_AVX2(_mm256_xor_si256(b, c)); \
+  } while(0)
+
+/*One Round of the Blake2b's compression function (same as ROUND_LYRA)*/
+#define ROUND_LYRA_AVX2 \
+  do { \
+    G_AVX2(a, b, c, d); \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0,3,2,1)); \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1,0,3,2)); \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2,1,0,3)); \
+    G_AVX2(a, b, c, d); \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2,1,0,3)); \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1,0,3,2)); \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0,3,2,1)); \
+  } while(0)
+
+#define LOAD_STATE_AVX2(s) \
+    __m256i a = _mm256_loadu_si256((const __m256i*)((s) + 0)); \
+    __m256i b = _mm256_loadu_si256((const __m256i*)((s) + 4)); \
+    __m256i c = _mm256_loadu_si256((const __m256i*)((s) + 8)); \
+    __m256i d = _mm256_loadu_si256((const __m256i*)((s) + 12))
+
+#define STORE_STATE_AVX2(s) \
+  do { \
+    _mm256_storeu_si256((__m256i*)((s) + 0), a); \
+    _mm256_storeu_si256((__m256i*)((s) + 4), b); \
+    _mm256_storeu_si256((__m256i*)((s) + 8), c); \
+    _mm256_storeu_si256((__m256i*)((s) + 12), d); \
+  } while(0)
+
+#define LOADW_AVX2(p, i) _mm256_loadu_si256((const __m256i*)((p) + 4 * (i)))
+#define STOREW_AVX2(p, i, x) _mm256_storeu_si256((__m256i*)((p) + 4 * (i)), (x))
+
+/*M[rowInOut][col] ^= rotW(rand): (s11,s0,s1,s2), (s3,s4,s5,s6), (s7,s8,s9,s10)*/
+#define XOR_ROTW_AVX2(p) \
+  do { \
+    const __m256i pa = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(2,1,0,3)); \
+    const __m256i pb = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2,1,0,3)); \
+    const __m256i pc = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(2,1,0,3)); \
+    STOREW_AVX2(p, 0, _mm256_xor_si256(LOADW_AVX2(p, 0), _mm256_blend_epi32(pa, pc, 0x03))); \
+    STOREW_AVX2(p, 1, _mm256_xor_si256(LOADW_AVX2(p, 1), _mm256_blend_epi32(pb, pa, 0x03))); \
+    STOREW_AVX2(p, 2, _mm256_xor_si256(LOADW_AVX2(p, 2), _mm256_blend_epi32(pc, pb, 0x03))); \
+  } while(0)
+
+AVX2_TARGET void blake2bLyra_avx2(uint64_t *v) {
+    int i;
+    DECLARE_ROTR_MASKS_AVX2;
+    LOAD_STATE_AVX2(v);
+    for (i = 0; i < 12; i++) {
+        ROUND_LYRA_AVX2;
+    }
+    STORE_STATE_AVX2(v);
+}
+
+AVX2_TARGET void reducedSqueezeRow0_avx2(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
+    uint64_t* ptrWord = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to M[0][C-1]
+    uint64_t i;
+    DECLARE_ROTR_MASKS_AVX2;
+    LOAD_STATE_AVX2(state);
+
+    for (i = 0; i < nCols; i++) {
+        STOREW_AVX2(ptrWord, 0, a);
+        STOREW_AVX2(ptrWord, 1, b);
+        STOREW_AVX2(ptrWord, 2, c);
+
+        ptrWord -= BLOCK_LEN_INT64;
+        ROUND_LYRA_AVX2;
+    }
+    STORE_STATE_AVX2(state);
+}
+
+AVX2_TARGET void reducedDuplexRow1_avx2(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
+    uint64_t* ptrWordIn = rowIn;
+    uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    uint64_t i;
+    DECLARE_ROTR_MASKS_AVX2;
+    LOAD_STATE_AVX2(state);
+
+    for (i = 0; i < nCols; i++) {
+        const __m256i in0 = LOADW_AVX2(ptrWordIn, 0), in1 = LOADW_AVX2(ptrWordIn, 1), in2 = LOADW_AVX2(ptrWordIn, 2);
+
+        a = _mm256_xor_si256(a, in0);
+        b = _mm256_xor_si256(b, in1);
+        c = _mm256_xor_si256(c, in2);
+        ROUND_LYRA_AVX2;
+
+        //M[row][C-1-col] = M[prev][col] XOR rand
+        STOREW_AVX2(ptrWordOut, 0, _mm256_xor_si256(in0, a));
+        STOREW_AVX2(ptrWordOut, 1, _mm256_xor_si256(in1, b));
+        STOREW_AVX2(ptrWordOut, 2, _mm256_xor_si256(in2, c));
+
+        ptrWordIn += BLOCK_LEN_INT64;
+        ptrWordOut -= BLOCK_LEN_INT64;
+    }
+    STORE_STATE_AVX2(state);
+}
+
+AVX2_TARGET void reducedDuplexRowSetup_avx2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    uint64_t* ptrWordIn = rowIn;
+    uint64_t* ptrWordInOut = rowInOut;
+    uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    uint64_t i;
+    DECLARE_ROTR_MASKS_AVX2;
+    LOAD_STATE_AVX2(state);
+
+    for (i = 0; i < nCols; i++) {
+        const __m256i in0 = LOADW_AVX2(ptrWordIn, 0), in1 = LOADW_AVX2(ptrWordIn, 1), in2 = LOADW_AVX2(ptrWordIn, 2);
+
+        //Absorbing "M[prev] [+] M[row*]"
+        a = _mm256_xor_si256(a, _mm256_add_epi64(in0, LOADW_AVX2(ptrWordInOut, 0)));
+        b = _mm256_xor_si256(b, _mm256_add_epi64(in1, LOADW_AVX2(ptrWordInOut, 1)));
+        c = _mm256_xor_si256(c, _mm256_add_epi64(in2, LOADW_AVX2(ptrWordInOut, 2)));
+        ROUND_LYRA_AVX2;
+
+        //M[row][col] = M[prev][col] XOR rand
+        STOREW_AVX2(ptrWordOut, 0, _mm256_xor_si256(in0, a));
+        STOREW_AVX2(ptrWordOut, 1, _mm256_xor_si256(in1, b));
+        STOREW_AVX2(ptrWordOut, 2, _mm256_xor_si256(in2, c));
+
+        //M[row*][col] = M[row*][col] XOR rotW(rand)
+        XOR_ROTW_AVX2(ptrWordInOut);
+
+        ptrWordInOut += BLOCK_LEN_INT64;
+        ptrWordIn += BLOCK_LEN_INT64;
+        ptrWordOut -= BLOCK_LEN_INT64;
+    }
+    STORE_STATE_AVX2(state);
+}
+
+AVX2_TARGET void reducedDuplexRow_avx2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    uint64_t* ptrWordInOut = rowInOut;
+    uint64_t* ptrWordIn = rowIn;
+    uint64_t* ptrWordOut = rowOut;
+    uint64_t i;
+    DECLARE_ROTR_MASKS_AVX2;
+    LOAD_STATE_AVX2(state);
+
+    for (i = 0; i < nCols; i++) {
+        //Absorbing "M[prev] [+] M[row*]"
+        a = _mm256_xor_si256(a, _mm256_add_epi64(LOADW_AVX2(ptrWordIn, 0), LOADW_AVX2(ptrWordInOut, 0)));
+        b = _mm256_xor_si256(b, _mm256_add_epi64(LOADW_AVX2(ptrWordIn, 1), LOADW_AVX2(ptrWordInOut, 1)));
+        c = _mm256_xor_si256(c, _mm256_add_epi64(LOADW_AVX2(ptrWordIn, 2), LOADW_AVX2(ptrWordInOut, 2)));
+        ROUND_LYRA_AVX2;
+
+        //M[rowOut][col] = M[rowOut][col] XOR rand
+        STOREW_AVX2(ptrWordOut, 0, _mm256_xor_si256(LOADW_AVX2(ptrWordOut, 0), a));
+        STOREW_AVX2(ptrWordOut, 1, _mm256_xor_si256(LOADW_AVX2(ptrWordOut, 1), b));
+        STOREW_AVX2(ptrWordOut, 2, _mm256_xor_si256(LOADW_AVX2(ptrWordOut, 2), c));
+
+        //M[rowInOut][col] = M[rowInOut][col] XOR rotW(rand)
+        //(rowOut may be the same row as rowInOut, so this reloads it)
+        XOR_ROTW_AVX2(ptrWordInOut);
+
+        ptrWordOut += BLOCK_LEN_INT64;
+        ptrWordInOut += BLOCK_LEN_INT64;
+        ptrWordIn += BLOCK_LEN_INT64;
+    }
+    STORE_STATE_AVX2(state);
+}
+
+#endif /* LYRA2_SPONGE_X86 */
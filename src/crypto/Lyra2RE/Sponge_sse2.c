@@ -0,0 +1,234 @@
+/**
+ * SSE2 implementation of the Blake2b based sponge used by Lyra2.
+ *
+ * The sponge state is kept in eight 128-bit registers for the duration of a
+ * row operation instead of being loaded from and stored to memory around
+ * every round. Results are bit-for-bit identical to Sponge.c.
+ *
+ * This software is hereby placed in the public domain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Sponge.h"
+#include "Lyra2.h"
+
+#ifdef LYRA2_SPONGE_X86
+
+#include <emmintrin.h>
+
+/*Blake2b's rotations*/
+#define ROTR32_SSE2(x) _mm_shuffle_epi32((x), _MM_SHUFFLE(2,3,0,1))
+#define ROTR_SSE2(x, c) _mm_or_si128(_mm_srli_epi64((x), (c)), _mm_slli_epi64((x), 64 - (c)))
+#define ROTR63_SSE2(x) _mm_or_si128(_mm_srli_epi64((x), 63), _mm_add_epi64((x), (x)))
+
+/*(x[1], y[0]): used to move the rows in and out of diagonal form and for rotW*/
+#define SHUF_SSE2(x, y) _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(x), _mm_castsi128_pd(y), 1))
+
+/*Blake2b's G function, applied to two columns at once*/
+#define G_SSE2(a0,a1,b0,b1,c0,c1,d0,d1) \
+  do { \
+    a0 = _mm_add_epi64(a0, b0); a1 = _mm_add_epi64(a1, b1); \
+    d0 = ROTR32_SSE2(_mm_xor_si128(d0, a0)); d1 = ROTR32_SSE2(_mm_xor_si128(d1, a1)); \
+    c0 = _mm_add_epi64(c0, d0); c1 = _mm_add_epi64(c1, d1); \
+    b0 = ROTR_SSE2(_mm_xor_si128(b0, c0), 24); b1 = ROTR_SSE2(_mm_xor_si128(b1, c1), 24); \
+    a0 = _mm_add_epi64(a0, b0); a1 = _mm_add_epi64(a1, b1); \
+    d0 = ROTR_SSE2(_mm_xor_si128(d0, a0), 16); d1 = ROTR_SSE2(_mm_xor_si128(d1, a1), 16); \
+    c0 = _mm_add_epi64(c0, d0); c1 = _mm_add_epi64(c1, d1); \
+    b0 = ROTR63_SSE2(_mm_xor_si128(b0, c0)); b1 = ROTR63_SSE2(_mm_xor_si128(b1, c1)); \
+  } while(0)
+
+/*One Round of the Blake2b's compression function (same as ROUND_LYRA)*/
+#define ROUND_LYRA_SSE2 \
+  do { \
+    __m128i t0, t1; \
+    G_SSE2(a0,a1,b0,b1,c0,c1,d0,d1); \
+    t0 = SHUF_SSE2(b0, b1); t1 = SHUF_SSE2(b1, b0); b0 = t0; b1 = t1; \
+    t0 = c0; c0 = c1; c1 = t0; \
+    t0 = SHUF_SSE2(d1, d0); t1 = SHUF_SSE2(d0, d1); d0 = t0; d1 = t1; \
+    G_SSE2(a0,a1,b0,b1,c0,c1,d0,d1); \
+    t0 = SHUF_SSE2(b1, b0); t1 = SHUF_SSE2(b0, b1); b0 = t0; b1 = t1; \
+    t0 = c0; c0 = c1; c1 = t0; \
+    t0 = SHUF_SSE2(d0, d1); t1 = SHUF_SSE2(d1, d0); d0 = t0; d1 = t1; \
+  } while(0)
+
+#define LOAD_STATE_SSE2(s) \
+    __m128i a0 = _mm_loadu_si128((const __m128i*)((s) + 0)); \
+    __m128i a1 = _mm_loadu_si128((const __m128i*)((s) + 2)); \
+    __m128i b0 = _mm_loadu_si128((const __m128i*)((s) + 4)); \
+    __m128i b1 = _mm_loadu_si128((const __m128i*)((s) + 6)); \
+    __m128i c0 = _mm_loadu_si128((const __m128i*)((s) + 8)); \
+    __m128i c1 = _mm_loadu_si128((const __m128i*)((s) + 10)); \
+    __m128i d0 = _mm_loadu_si128((const __m128i*)((s) + 12)); \
+    __m128i d1 = _mm_loadu_si128((const __m128i*)((s) + 14))
+
+#define STORE_STATE_SSE2(s) \
+  do { \
+    _mm_storeu_si128((__m128i*)((s) + 0), a0); \
+    _mm_storeu_si128((__m128i*)((s) + 2), a1); \
+    _mm_storeu_si128((__m128i*)((s) + 4), b0); \
+    _mm_storeu_si128((__m128i*)((s) + 6), b1); \
+    _mm_storeu_si128((__m128i*)((s) + 8), c0); \
+    _mm_storeu_si128((__m128i*)((s) + 10), c1); \
+    _mm_storeu_si128((__m128i*)((s) + 12), d0); \
+    _mm_storeu_si128((__m128i*)((s) + 14), d1); \
+  } while(0)
+
+#define LOADW_SSE2(p, i) _mm_loadu_si128((const __m128i*)((p) + 2 * (i)))
+#define STOREW_SSE2(p, i, x) _mm_storeu_si128((__m128i*)((p) + 2 * (i)), (x))
+
+/*Absorbs one column: state ^= x0..x5*/
+#define ABSORB_SSE2(x0,x1,x2,x3,x4,x5) \
+  do { \
+    a0 = _mm_xor_si128(a0, x0); a1 = _mm_xor_si128(a1, x1); \
+    b0 = _mm_xor_si128(b0, x2); b1 = _mm_xor_si128(b1, x3); \
+    c0 = _mm_xor_si128(c0, x4); c1 = _mm_xor_si128(c1, x5); \
+  } while(0)
+
+/*M[rowInOut][col] ^= rotW(rand)*/
+#define XOR_ROTW_SSE2(p) \
+  do { \
+    STOREW_SSE2(p, 0, _mm_xor_si128(LOADW_SSE2(p, 0), SHUF_SSE2(c1, a0))); \
+    STOREW_SSE2(p, 1, _mm_xor_si128(LOADW_SSE2(p, 1), SHUF_SSE2(a0, a1))); \
+    STOREW_SSE2(p, 2, _mm_xor_si128(LOADW_SSE2(p, 2), SHUF_SSE2(a1, b0))); \
+    STOREW_SSE2(p, 3, _mm_xor_si128(LOADW_SSE2(p, 3), SHUF_SSE2(b0, b1))); \
+    STOREW_SSE2(p, 4, _mm_xor_si128(LOADW_SSE2(p, 4), SHUF_SSE2(b1, c0))); \
+    STOREW_SSE2(p, 5, _mm_xor_si128(LOADW_SSE2(p, 5), SHUF_SSE2(c0, c1))); \
+  } while(0)
+
+void blake2bLyra_sse2(uint64_t *v) {
+    int i;
+    LOAD_STATE_SSE2(v);
+    for (i = 0; i < 12; i++) {
+        ROUND_LYRA_SSE2;
+    }
+    STORE_STATE_SSE2(v);
+}
+
+void reducedSqueezeRow0_sse2(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
+    uint64_t* ptrWord = rowOut + (nCols-1)*BLOCK_LEN_INT64; //In Lyra2: pointer to M[0][C-1]
+    uint64_t i;
+    LOAD_STATE_SSE2(state);
+
+    for (i = 0; i < nCols; i++) {
+        STOREW_SSE2(ptrWord, 0, a0);
+        STOREW_SSE2(ptrWord, 1, a1);
+        STOREW_SSE2(ptrWord, 2, b0);
+        STOREW_SSE2(ptrWord, 3, b1);
+        STOREW_SSE2(ptrWord, 4, c0);
+        STOREW_SSE2(ptrWord, 5, c1);
+
+        ptrWord -= BLOCK_LEN_INT64;
+        ROUND_LYRA_SSE2;
+    }
+    STORE_STATE_SSE2(state);
+}
+
+void reducedDuplexRow1_sse2(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
+    uint64_t* ptrWordIn = rowIn;
+    uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    uint64_t i;
+    LOAD_STATE_SSE2(state);
+
+    for (i = 0; i < nCols; i++) {
+        const __m128i in0 = LOADW_SSE2(ptrWordIn, 0), in1 = LOADW_SSE2(ptrWordIn, 1), in2 = LOADW_SSE2(ptrWordIn, 2);
+        const __m128i in3 = LOADW_SSE2(ptrWordIn, 3), in4 = LOADW_SSE2(ptrWordIn, 4), in5 = LOADW_SSE2(ptrWordIn, 5);
+
+        ABSORB_SSE2(in0, in1, in2, in3, in4, in5);
+        ROUND_LYRA_SSE2;
+
+        //M[row][C-1-col] = M[prev][col] XOR rand
+        STOREW_SSE2(ptrWordOut, 0, _mm_xor_si128(in0, a0));
+        STOREW_SSE2(ptrWordOut, 1, _mm_xor_si128(in1, a1));
+        STOREW_SSE2(ptrWordOut, 2, _mm_xor_si128(in2, b0));
+        STOREW_SSE2(ptrWordOut, 3, _mm_xor_si128(in3, b1));
+        STOREW_SSE2(ptrWordOut, 4, _mm_xor_si128(in4, c0));
+        STOREW_SSE2(ptrWordOut, 5, _mm_xor_si128(in5, c1));
+
+        ptrWordIn += BLOCK_LEN_INT64;
+        ptrWordOut -= BLOCK_LEN_INT64;
+    }
+    STORE_STATE_SSE2(state);
+}
+
+void reducedDuplexRowSetup_sse2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    uint64_t* ptrWordIn = rowIn;
+    uint64_t* ptrWordInOut = rowInOut;
+    uint64_t* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    uint64_t i;
+    LOAD_STATE_SSE2(state);
+
+    for (i = 0; i < nCols; i++) {
+        const __m128i in0 = LOADW_SSE2(ptrWordIn, 0), in1 = LOADW_SSE2(ptrWordIn, 1), in2 = LOADW_SSE2(ptrWordIn, 2);
+        const __m128i in3 = LOADW_SSE2(ptrWordIn, 3), in4 = LOADW_SSE2(ptrWordIn, 4), in5 = LOADW_SSE2(ptrWordIn, 5);
+
+        //Absorbing "M[prev] [+] M[row*]"
+        ABSORB_SSE2(_mm_add_epi64(in0, LOADW_SSE2(ptrWordInOut, 0)), _mm_add_epi64(in1, LOADW_SSE2(ptrWordInOut, 1)),
+                    _mm_add_epi64(in2, LOADW_SSE2(ptrWordInOut, 2)), _mm_add_epi64(in3, LOADW_SSE2(ptrWordInOut, 3)),
+                    _mm_add_epi64(in4, LOADW_SSE2(ptrWordInOut, 4)), _mm_add_epi64(in5, LOADW_SSE2(ptrWordInOut, 5)));
+        ROUND_LYRA_SSE2;
+
+        //M[row][col] = M[prev][col] XOR rand
+        STOREW_SSE2(ptrWordOut, 0, _mm_xor_si128(in0, a0));
+        STOREW_SSE2(ptrWordOut, 1, _mm_xor_si128(in1, a1));
+        STOREW_SSE2(ptrWordOut, 2, _mm_xor_si128(in2, b0));
+        STOREW_SSE2(ptrWordOut, 3, _mm_xor_si128(in3, b1));
+        STOREW_SSE2(ptrWordOut, 4, _mm_xor_si128(in4, c0));
+        STOREW_SSE2(ptrWordOut, 5, _mm_xor_si128(in5, c1));
+
+        //M[row*][col] = M[row*][col] XOR rotW(rand)
+        XOR_ROTW_SSE2(ptrWordInOut);
+
+        ptrWordInOut += BLOCK_LEN_INT64;
+        ptrWordIn += BLOCK_LEN_INT64;
+        ptrWordOut -= BLOCK_LEN_INT64;
+    }
+    STORE_STATE_SSE2(state);
+}
+
+void reducedDuplexRow_sse2(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    uint64_t* ptrWordInOut = rowInOut;
+    uint64_t* ptrWordIn = rowIn;
+    uint64_t* ptrWordOut = rowOut;
+    uint64_t i;
+    LOAD_STATE_SSE2(state);
+
+    for (i = 0; i < nCols; i++) {
+        //Absorbing "M[prev] [+] M[row*]"
+        ABSORB_SSE2(_mm_add_epi64(LOADW_SSE2(ptrWordIn, 0), LOADW_SSE2(ptrWordInOut, 0)),
+                    _mm_add_epi64(LOADW_SSE2(ptrWordIn, 1), LOADW_SSE2(ptrWordInOut, 1)),
+                    _mm_add_epi64(LOADW_SSE2(ptrWordIn, 2), LOADW_SSE2(ptrWordInOut, 2)),
+                    _mm_add_epi64(LOADW_SSE2(ptrWordIn, 3), LOADW_SSE2(ptrWordInOut, 3)),
+                    _mm_add_epi64(LOADW_SSE2(ptrWordIn, 4), LOADW_SSE2(ptrWordInOut, 4)),
+                    _mm_add_epi64(LOADW_SSE2(ptrWordIn, 5), LOADW_SSE2(ptrWordInOut, 5)));
+        ROUND_LYRA_SSE2;
+
+        //M[rowOut][col] = M[rowOut][col] XOR rand
+        STOREW_SSE2(ptrWordOut, 0, _mm_xor_si128(LOADW_SSE2(ptrWordOut, 0), a0));
+        STOREW_SSE2(ptrWordOut, 1, _mm_xor_si128(LOADW_SSE2(ptrWordOut, 1), a1));
+        STOREW_SSE2(ptrWordOut, 2, _mm_xor_si128(LOADW_SSE2(ptrWordOut, 2), b0));
+        STOREW_SSE2(ptrWordOut, 3, _mm_xor_si128(LOADW_SSE2(ptrWordOut, 3), b1));
+        STOREW_SSE2(ptrWordOut, 4, _mm_xor_si128(LOADW_SSE2(ptrWordOut, 4), c0));
+        STOREW_SSE2(ptrWordOut, 5, _mm_xor_si128(LOADW_SSE2(ptrWordOut, 5), c1));
+
+        //M[rowInOut][col] = M[rowInOut][col] XOR rotW(rand)
+        //(rowOut may be the same row as rowInOut, so this reloads it)
+        XOR_ROTW_SSE2(ptrWordInOut);
+
+        ptrWordOut += BLOCK_LEN_INT64;
+        ptrWordInOut += BLOCK_LEN_INT64;
+        ptrWordIn += BLOCK_LEN_INT64;
+    }
+    STORE_STATE_SSE2(state);
+}
+
+#endif /* LYRA2_SPONGE_X86 */
@@ -7,6 +7,8 @@
 #include "util.h"
 #include "random.h"
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -73,14 +75,63 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+bool CDBOptions::Parse(const std::string& strOptions, std::string& strError)
+{
+    std::vector<std::string> vOptions;
+    boost::split(vOptions, strOptions, boost::is_any_of(","));
+    for (const std::string& strOption : vOptions) {
+        if (strOption.empty())
+            continue;
+        size_t nPos = strOption.find('=');
+        std::string strKey = strOption.substr(0, nPos);
+        int64_t nValue;
+        if (nPos == std::string::npos || !ParseInt64(strOption.substr(nPos + 1), &nValue) || nValue < 0) {
+            strError = strprintf("invalid value in '%s'", strOption);
+            return false;
+        }
+        if (strKey == "compression") {
+            fCompression = nValue != 0;
+        } else if (strKey == "maxopenfiles" && nValue >= 16 && nValue <= 100000) {
+            nMaxOpenFiles = nValue;
+        } else if (strKey == "bloombits" && nValue <= 64) {
+            nBloomBits = nValue;
+        } else if (strKey == "blockcache" && nValue <= 90) {
+            nBlockCachePercent = nValue;
+        } else if (strKey == "blocksize" && nValue >= 1024 && nValue <= 1024 * 1024) {
+            nBlockSize = nValue;
+        } else {
+            strError = strprintf("unknown option or value out of range in '%s'", strOption);
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string CDBOptions::ToString() const
+{
+    return strprintf("compression=%d,maxopenfiles=%d,bloombits=%d,blockcache=%d,blocksize=%u", fCompression, nMaxOpenFiles, nBloomBits, nBlockCachePercent, nBlockSize);
+}
+
+/**
+ * Whether LevelDB compresses table blocks. Its port layer only does so when it
+ * is built with SNAPPY defined (see Makefile.leveldb.include), and silently
+ * stores blocks uncompressed otherwise.
+ */
+#ifdef SNAPPY
+static const bool fCompressionSupported = true;
+#else
+static const bool fCompressionSupported = false;
+#endif
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbopts)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = leveldb::NewLRUCache(nCacheSize * dbopts.nBlockCachePercent / 100);
+    options.write_buffer_size = nCacheSize * (100 - dbopts.nBlockCachePercent) / 200; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = dbopts.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbopts.nBloomBits) : NULL;
+    options.compression = dbopts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbopts.nMaxOpenFiles;
+    options.block_size = dbopts.nBlockSize;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -90,14 +141,18 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dbopts) : dboptions(dbopts)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    if (dboptions.fCompression && !fCompressionSupported) {
+        LogPrintf("Warning: LevelDB was built without Snappy, compression is turned off for %s\n", path.string());
+        dboptions.fCompression = false;
+    }
+    options = GetOptions(nCacheSize, dboptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -109,7 +164,7 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
             dbwrapper_private::HandleError(result);
         }
         TryCreateDirectory(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("Opening LevelDB in %s (%s)\n", path.string(), dboptions.ToString());
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
@@ -192,7 +247,9 @@ bool CDBWrapper::IsEmpty()
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
+void CDBIterator::SeekToLast() { piter->SeekToLast(); }
 void CDBIterator::Next() { piter->Next(); }
+void CDBIterator::Prev() { piter->Prev(); }
 
 namespace dbwrapper_private {
 
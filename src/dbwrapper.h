@@ -28,6 +28,30 @@ public:
 
 class CDBWrapper;
 
+/**
+ * LevelDB tuning for one database. Given on the command line as a comma
+ * separated list of key=value pairs, e.g. "compression=1,maxopenfiles=500".
+ */
+struct CDBOptions
+{
+    //! Snappy-compress table blocks; turned off when opening the database if LevelDB was built without Snappy
+    bool fCompression;
+    //! Number of table files LevelDB may keep open
+    int nMaxOpenFiles;
+    //! Bits per key of the bloom filter, 0 to disable it
+    int nBloomBits;
+    //! Share of the cache (in percent) used for the block cache, the rest goes to the two write buffers
+    int nBlockCachePercent;
+    //! Approximate size of uncompressed data per table block
+    size_t nBlockSize;
+
+    CDBOptions() : fCompression(false), nMaxOpenFiles(64), nBloomBits(10), nBlockCachePercent(50), nBlockSize(4096) {}
+
+    //! Override the settings named in strOptions; returns false (with strError set) on an unknown key or bad value
+    bool Parse(const std::string& strOptions, std::string& strError);
+    std::string ToString() const;
+};
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -132,6 +156,8 @@ public:
 
     void SeekToFirst();
 
+    void SeekToLast();
+
     template<typename K> void Seek(const K& key) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
@@ -142,6 +168,8 @@ public:
 
     void Next();
 
+    void Prev();
+
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
         try {
@@ -185,6 +213,9 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! tuning the options were built from
+    CDBOptions dboptions;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -219,8 +250,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dbopts      LevelDB tuning for this database.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dbopts = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -308,6 +340,14 @@ public:
      */
     bool IsEmpty();
 
+    //! Query a LevelDB property such as "leveldb.stats"; returns false if it is unknown
+    bool GetProperty(const std::string& strProperty, std::string& strValue) const
+    {
+        return pdb->GetProperty(strProperty, &strValue);
+    }
+
+    const CDBOptions& GetDBOptions() const { return dboptions; }
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
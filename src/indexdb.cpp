@@ -0,0 +1,673 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexdb.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <map>
+
+#include <boost/thread.hpp>
+
+static const char DB_ADDRESSINDEX = 'a';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCE = 'A';
+static const char DB_TIMESTAMPINDEX = 's';
+static const char DB_SPENTINDEX = 'p';
+
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_FLAG = 'F';
+
+CIndexDB *pindexdb = NULL;
+
+namespace {
+
+CWaitableCriticalSection csIndexSync;
+CConditionVariable condIndexSync;
+/** Last block applied to pindexdb, only changed by the index thread */
+const CBlockIndex *pindexIndexed = NULL;
+/** Whether the index thread has caught up with the active chain since startup */
+bool fIndexSynced = false;
+/** Whether the active chain tip changed since the index thread last looked */
+bool fIndexTipChanged = false;
+/** Whether the index thread is running */
+bool fIndexSyncRunning = false;
+
+/** Address type (1 for P2PKH and P2PK, 2 for P2SH) and hash a script pays to, 0 if it has none */
+int GetAddressOfScript(const CScript &script, uint160 &hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+2, script.begin()+22));
+        return 2;
+    } else if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+3, script.begin()+23));
+        return 1;
+    } else if (script.IsPayToPublicKey()) {
+        hashBytes = Hash160(script.begin()+1, script.end()-1);
+        return 1;
+    }
+    hashBytes.SetNull();
+    return 0;
+}
+
+/** Move all entries with one key prefix from one database to another */
+template <typename K, typename V>
+bool MoveEntries(CDBWrapper &from, CDBWrapper &to, char chPrefix, int64_t &nMoved)
+{
+    std::unique_ptr<CDBIterator> pcursor(from.NewIterator());
+    pcursor->Seek(chPrefix);
+
+    size_t batch_size = 1 << 24;
+    CDBBatch batchTo(to);
+    CDBBatch batchFrom(from);
+    std::pair<char, K> key;
+    V value;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != chPrefix)
+            break;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read index entry", __func__);
+        batchTo.Write(key, value);
+        batchFrom.Erase(key);
+        nMoved++;
+        if (batchTo.SizeEstimate() > batch_size) {
+            // Entries only disappear from the old database once they are in the new one
+            if (!to.WriteBatch(batchTo) || !from.WriteBatch(batchFrom))
+                return false;
+            batchTo.Clear();
+            batchFrom.Clear();
+        }
+        pcursor->Next();
+    }
+    return to.WriteBatch(batchTo) && from.WriteBatch(batchFrom);
+}
+
+/** Marks the index thread as running while it exists, waking up waiting queries when it stops */
+struct CIndexSyncRunning
+{
+    CIndexSyncRunning() {
+        boost::unique_lock<boost::mutex> lock(csIndexSync);
+        fIndexSyncRunning = true;
+    }
+    ~CIndexSyncRunning() {
+        boost::unique_lock<boost::mutex> lock(csIndexSync);
+        fIndexSyncRunning = false;
+        condIndexSync.notify_all();
+    }
+};
+
+} // anon namespace
+
+CIndexDB::CIndexDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbopts) : CDBWrapper(GetDataDir() / "indexes", nCacheSize, fMemory, fWipe, false, dbopts) {
+}
+
+bool CIndexDB::ReadBestBlock(uint256 &hash) {
+    return Read(DB_BEST_BLOCK, hash);
+}
+
+bool CIndexDB::ConnectBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex) {
+    return WriteBlock(block, blockundo, pindex, false);
+}
+
+bool CIndexDB::DisconnectBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex) {
+    return WriteBlock(block, blockundo, pindex, true);
+}
+
+bool CIndexDB::WriteBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex, bool fDisconnect) {
+    CDBBatch batch(*this);
+
+    // The genesis block has no spendable outputs and is not indexed
+    if (pindex->pprev != NULL) {
+        if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+            return error("%s: block and undo data inconsistent", __func__);
+
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+
+        // Transactions are undone in reverse order, so that an output spent
+        // within the block is restored before it is removed again
+        int nTx = block.vtx.size();
+        for (int n = 0; n < nTx; n++) {
+            int i = fDisconnect ? nTx - 1 - n : n;
+            const CTransaction &tx = *(block.vtx[i]);
+            const uint256 txhash = tx.GetHash();
+            uint160 hashBytes;
+            int addressType;
+
+            if (i > 0) {
+                const CTxUndo &txundo = blockundo.vtxundo[i-1];
+                if (txundo.vprevout.size() != tx.vin.size())
+                    return error("%s: transaction and undo data inconsistent", __func__);
+
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const COutPoint &prevout = tx.vin[j].prevout;
+                    const Coin &coin = txundo.vprevout[j];
+                    addressType = GetAddressOfScript(coin.out.scriptPubKey, hashBytes);
+
+                    if (fAddressIndex && addressType > 0) {
+                        // spending activity, and the output leaves (or returns to) the unspent index
+                        addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), coin.out.nValue * -1));
+                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, prevout.hash, prevout.n),
+                            fDisconnect ? CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight) : CAddressUnspentValue()));
+                    }
+
+                    if (fSpentIndex) {
+                        // the txid and input that spent an output, and the amount and address of the input
+                        spentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n),
+                            fDisconnect ? CSpentIndexValue() : CSpentIndexValue(txhash, j, pindex->nHeight, coin.out.nValue, addressType, hashBytes)));
+                    }
+                }
+            }
+
+            if (fAddressIndex) {
+                for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                    const CTxOut &out = tx.vout[k];
+                    addressType = GetAddressOfScript(out.scriptPubKey, hashBytes);
+                    if (addressType == 0)
+                        continue;
+
+                    // receiving activity and the new unspent output
+                    addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k),
+                        fDisconnect ? CAddressUnspentValue() : CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+                }
+            }
+        }
+
+        AddressIndexToBatch(batch, addressIndex, fDisconnect);
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=addressUnspentIndex.begin(); it!=addressUnspentIndex.end(); it++) {
+            if (it->second.IsNull()) {
+                batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+            } else {
+                batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+            }
+        }
+        for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=spentIndex.begin(); it!=spentIndex.end(); it++) {
+            if (it->second.IsNull()) {
+                batch.Erase(std::make_pair(DB_SPENTINDEX, it->first));
+            } else {
+                batch.Write(std::make_pair(DB_SPENTINDEX, it->first), it->second);
+            }
+        }
+
+        if (fTimestampIndex) {
+            std::pair<char, CTimestampIndexKey> key(DB_TIMESTAMPINDEX, CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+            if (fDisconnect)
+                batch.Erase(key);
+            else
+                batch.Write(key, 0);
+        }
+    }
+
+    batch.Write(DB_BEST_BLOCK, fDisconnect ? pindex->pprev->GetBlockHash() : pindex->GetBlockHash());
+    return WriteBatch(batch);
+}
+
+/**
+ * Versions that wrote the indexes while connecting blocks kept them in the
+ * block tree database, up to date with the chain tip. Move them over rather
+ * than building them again from the block files.
+ */
+bool CIndexDB::Upgrade(CBlockTreeDB &blocktree, const uint256 &hashBestChain) {
+    int64_t nMoved = 0;
+    if (!MoveEntries<CAddressIndexKey, CAmount>(blocktree, *this, DB_ADDRESSINDEX, nMoved) ||
+        !MoveEntries<CAddressUnspentKey, CAddressUnspentValue>(blocktree, *this, DB_ADDRESSUNSPENTINDEX, nMoved) ||
+        !MoveEntries<CAddressIndexIteratorKey, CAddressBalanceValue>(blocktree, *this, DB_ADDRESSBALANCE, nMoved) ||
+        !MoveEntries<CTimestampIndexKey, int>(blocktree, *this, DB_TIMESTAMPINDEX, nMoved) ||
+        !MoveEntries<CSpentIndexKey, CSpentIndexValue>(blocktree, *this, DB_SPENTINDEX, nMoved))
+        return error("%s: failed to move the indexes out of the block tree database", __func__);
+    if (nMoved == 0 || hashBestChain.IsNull())
+        return true;
+
+    LogPrintf("Moved %d index entries from the block tree database\n", nMoved);
+    CDBBatch batch(*this);
+    bool fBalanceIndex = false;
+    if (blocktree.ReadFlag("addressbalanceindex", fBalanceIndex))
+        batch.Write(std::make_pair(DB_FLAG, std::string("addressbalanceindex")), fBalanceIndex ? '1' : '0');
+    batch.Write(DB_BEST_BLOCK, hashBestChain);
+    return WriteBatch(batch, true);
+}
+
+bool CIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(std::make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
+                                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressUnspentKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
+            CAddressUnspentValue nValue;
+            if (pcursor->GetValue(nValue)) {
+                unspentOutputs.push_back(std::make_pair(key.second, nValue));
+                pcursor->Next();
+            } else {
+                return error("failed to get address unspent value");
+            }
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+CAddressUnspentCursor *CIndexDB::AddressUnspentCursor(uint160 addressHash, int type) {
+    return new CAddressUnspentCursor(NewIterator(), DB_ADDRESSUNSPENTINDEX, type, addressHash);
+}
+
+bool CIndexDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> >&vect) {
+    CDBBatch batch(*this);
+    AddressIndexToBatch(batch, vect, false);
+    return WriteBatch(batch);
+}
+
+bool CIndexDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> >&vect) {
+    CDBBatch batch(*this);
+    AddressIndexToBatch(batch, vect, true);
+    return WriteBatch(batch);
+}
+
+void CIndexDB::AddressIndexToBatch(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase) {
+    UpdateAddressBalanceIndex(batch, vect, fErase);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (fErase)
+            batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
+        else
+            batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    }
+}
+
+CAddressIndexCursor *CIndexDB::AddressIndexCursor(uint160 addressHash, int type) {
+    return new CAddressIndexCursor(NewIterator(), DB_ADDRESSINDEX, type, addressHash);
+}
+
+namespace {
+
+struct AddressBalanceDelta {
+    CAmount balance;
+    CAmount received;
+    unsigned int txCount;
+    int height;
+    uint256 lastTx;
+
+    AddressBalanceDelta() : balance(0), received(0), txCount(0), height(0) {}
+};
+
+}
+
+/**
+ * Fold a block's worth of address deltas that are about to be written or
+ * erased into the per-address balance records. Deltas that are already
+ * present (or already gone) are skipped, so the records always add up to
+ * exactly what ReadAddressIndex would return.
+ */
+void CIndexDB::UpdateAddressBalanceIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase) {
+    // The deltas of one transaction are adjacent, so a change of txhash per
+    // address is a new transaction
+    std::map<std::pair<unsigned int, uint160>, AddressBalanceDelta> mapDelta;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        CAmount nValue = it->second;
+        CAmount nStored;
+        if (Read(std::make_pair(DB_ADDRESSINDEX, it->first), nStored) != fErase)
+            continue;
+        if (fErase)
+            nValue = nStored;
+
+        AddressBalanceDelta& delta = mapDelta[std::make_pair(it->first.type, it->first.hashBytes)];
+        delta.balance += nValue;
+        if (nValue > 0)
+            delta.received += nValue;
+        if (it->first.txhash != delta.lastTx) {
+            delta.txCount++;
+            delta.lastTx = it->first.txhash;
+        }
+        delta.height = std::max(delta.height, it->first.blockHeight);
+    }
+
+    for (std::map<std::pair<unsigned int, uint160>, AddressBalanceDelta>::const_iterator it=mapDelta.begin(); it!=mapDelta.end(); it++) {
+        const AddressBalanceDelta& delta = it->second;
+        std::pair<char, CAddressIndexIteratorKey> key(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(it->first.first, it->first.second));
+        CAddressBalanceValue value;
+        if (!Read(key, value))
+            value.SetNull();
+
+        if (!fErase) {
+            value.balance += delta.balance;
+            value.received += delta.received;
+            value.txCount += delta.txCount;
+            value.lastHeight = std::max(value.lastHeight, delta.height);
+        } else {
+            value.balance -= delta.balance;
+            value.received -= delta.received;
+            value.txCount -= std::min(value.txCount, delta.txCount);
+            if (value.IsNull()) {
+                batch.Erase(key);
+                continue;
+            }
+            if (delta.height >= value.lastHeight)
+                value.lastHeight = FindLastAddressIndexHeight(it->first.second, it->first.first, delta.height);
+        }
+        batch.Write(key, value);
+    }
+}
+
+/** Height of the last address index entry of an address below beforeHeight, or 0 if there is none. */
+int CIndexDB::FindLastAddressIndexHeight(uint160 addressHash, int type, int beforeHeight) {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, beforeHeight)));
+    if (pcursor->Valid())
+        pcursor->Prev();
+    else
+        pcursor->SeekToLast();
+
+    std::pair<char,CAddressIndexKey> key;
+    if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX &&
+            key.second.type == (unsigned int)type && key.second.hashBytes == addressHash) {
+        return key.second.blockHeight;
+    }
+    return 0;
+}
+
+bool CIndexDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    return Read(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+}
+
+/**
+ * Build the address balance records for an address index written by a
+ * version that did not maintain them, in one pass over all address deltas.
+ */
+bool CIndexDB::UpgradeAddressBalanceIndex() {
+    bool fUpgraded = false;
+    if (ReadFlag("addressbalanceindex", fUpgraded) && fUpgraded)
+        return true;
+
+    LogPrintf("Building address balance index...\n");
+    LogPrintf("[0%%]...");
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey()));
+
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(*this);
+    int reportDone = 0;
+    int64_t count = 0;
+    std::pair<char,CAddressIndexKey> key;
+    CAddressIndexIteratorKey current;
+    CAddressBalanceValue value;
+    uint256 lastTx;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX)
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("%s: failed to get address index value", __func__);
+
+        if (key.second.type != current.type || key.second.hashBytes != current.hashBytes) {
+            if (!value.IsNull())
+                batch.Write(std::make_pair(DB_ADDRESSBALANCE, current), value);
+            if (batch.SizeEstimate() > batch_size) {
+                WriteBatch(batch);
+                batch.Clear();
+            }
+            current = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            value.SetNull();
+            lastTx.SetNull();
+        }
+        if (count++ % 4096 == 0) {
+            // Keys are sorted by address type (1 or 2), then by address
+            int percentageDone = (int)(((key.second.type - 1) * 256 + *key.second.hashBytes.begin()) * 100.0 / 512.0 + 0.5);
+            percentageDone = std::max(0, std::min(100, percentageDone));
+            uiInterface.ShowProgress(_("Building address balance index..."), percentageDone);
+            if (reportDone < percentageDone/10) {
+                // report max. every 10% step
+                LogPrintf("[%d%%]...", percentageDone);
+                reportDone = percentageDone/10;
+            }
+        }
+
+        value.balance += nValue;
+        if (nValue > 0)
+            value.received += nValue;
+        if (key.second.txhash != lastTx) {
+            value.txCount++;
+            lastTx = key.second.txhash;
+        }
+        value.lastHeight = key.second.blockHeight;
+        pcursor->Next();
+    }
+    if (!value.IsNull())
+        batch.Write(std::make_pair(DB_ADDRESSBALANCE, current), value);
+    batch.Write(std::make_pair(DB_FLAG, std::string("addressbalanceindex")), '1');
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[DONE].\n");
+    return WriteBatch(batch, true);
+}
+
+bool CIndexDB::ReadAddressIndex(uint160 addressHash, int type,
+                                std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                int start, int end) {
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    if (start > 0 && end > 0) {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+    } else {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
+            if (end > 0 && key.second.blockHeight > end) {
+                break;
+            }
+            CAmount nValue;
+            if (pcursor->GetValue(nValue)) {
+                addressIndex.push_back(std::make_pair(key.second, nValue));
+                pcursor->Next();
+            } else {
+                return error("failed to get address index value");
+            }
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CIndexDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CTimestampIndexKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_TIMESTAMPINDEX && key.second.timestamp <= high) {
+            hashes.push_back(key.second.blockHash);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CIndexDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CIndexDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+void CIndexSyncNotifier::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    boost::unique_lock<boost::mutex> lock(csIndexSync);
+    fIndexTipChanged = true;
+    condIndexSync.notify_all();
+}
+
+bool InitIndexDB(size_t nCacheSize, bool fWipe, const CDBOptions& dbopts)
+{
+    AssertLockHeld(cs_main);
+
+    delete pindexdb;
+    pindexdb = new CIndexDB(nCacheSize, false, fWipe, dbopts);
+
+    uint256 hashBest;
+    if (!pindexdb->ReadBestBlock(hashBest)) {
+        if (!pindexdb->Upgrade(*pblocktree, chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256()))
+            return false;
+        if (!pindexdb->ReadBestBlock(hashBest))
+            hashBest.SetNull();
+    }
+    if (!pindexdb->UpgradeAddressBalanceIndex())
+        return error("%s: failed to build the address balance index", __func__);
+
+    const CBlockIndex *pindexBest = NULL;
+    if (!hashBest.IsNull()) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+        if (mi == mapBlockIndex.end())
+            return error("%s: index database is synced to unknown block %s", __func__, hashBest.ToString());
+        pindexBest = mi->second;
+    }
+    LogPrintf("%s: indexes synced to height %d\n", __func__, pindexBest ? pindexBest->nHeight : -1);
+
+    boost::unique_lock<boost::mutex> lock(csIndexSync);
+    pindexIndexed = pindexBest;
+    fIndexSynced = false;
+    return true;
+}
+
+void ShutdownIndexDB()
+{
+    delete pindexdb;
+    pindexdb = NULL;
+    boost::unique_lock<boost::mutex> lock(csIndexSync);
+    pindexIndexed = NULL;
+}
+
+void ThreadIndexSync()
+{
+    RenameThread("bastoji-index");
+    CIndexSyncRunning running;
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    const CBlockIndex *pindexBest;
+    {
+        boost::unique_lock<boost::mutex> lock(csIndexSync);
+        pindexBest = pindexIndexed;
+    }
+
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        // Step back while the indexes are on a branch that left the active
+        // chain, otherwise apply the next block of the active chain
+        const CBlockIndex *pindex = NULL;
+        bool fDisconnect = false;
+        CDiskBlockPos undoPos;
+        {
+            LOCK(cs_main);
+            if (pindexBest != NULL && !chainActive.Contains(pindexBest)) {
+                pindex = pindexBest;
+                fDisconnect = true;
+            } else if (pindexBest != chainActive.Tip()) {
+                pindex = pindexBest ? chainActive.Next(pindexBest) : chainActive.Genesis();
+            }
+            if (pindex != NULL)
+                undoPos = pindex->GetUndoPos();
+        }
+
+        if (pindex == NULL) {
+            boost::unique_lock<boost::mutex> lock(csIndexSync);
+            if (!fIndexSynced) {
+                LogPrintf("%s: indexes caught up with the active chain at height %d\n", __func__, pindexBest ? pindexBest->nHeight : -1);
+                fIndexSynced = true;
+                condIndexSync.notify_all();
+            }
+            while (!fIndexTipChanged)
+                condIndexSync.wait(lock);
+            fIndexTipChanged = false;
+            continue;
+        }
+
+        int64_t nTimeStart = GetTimeMicros();
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams)) {
+            AbortNode(strprintf("Failed to read block %s for the indexes", pindex->GetBlockHash().ToString()));
+            return;
+        }
+        if (pindex->pprev != NULL && (undoPos.IsNull() || !UndoReadFromDisk(blockundo, undoPos, pindex->pprev->GetBlockHash()))) {
+            AbortNode(strprintf("Failed to read undo data of block %s for the indexes", pindex->GetBlockHash().ToString()));
+            return;
+        }
+        if (!(fDisconnect ? pindexdb->DisconnectBlock(block, blockundo, pindex) : pindexdb->ConnectBlock(block, blockundo, pindex))) {
+            AbortNode("Failed to write to the index database");
+            return;
+        }
+        LogPrint("bench", "- %s index entries of block %d: %.2fms\n", fDisconnect ? "Remove" : "Add", pindex->nHeight, 0.001 * (GetTimeMicros() - nTimeStart));
+
+        pindexBest = fDisconnect ? pindex->pprev : pindex;
+        boost::unique_lock<boost::mutex> lock(csIndexSync);
+        pindexIndexed = pindexBest;
+        condIndexSync.notify_all();
+    }
+}
+
+bool WaitForIndexSync()
+{
+    if (pindexdb == NULL)
+        return true;
+
+    while (true) {
+        const CBlockIndex *pindexBest;
+        {
+            boost::unique_lock<boost::mutex> lock(csIndexSync);
+            if (!fIndexSynced)
+                return false;
+            if (!fIndexSyncRunning)
+                return true;
+            pindexBest = pindexIndexed;
+        }
+        {
+            LOCK(cs_main);
+            if (pindexBest == chainActive.Tip())
+                return true;
+        }
+        // The index thread wakes us up for every block it applies
+        boost::unique_lock<boost::mutex> lock(csIndexSync);
+        if (fIndexSyncRunning && pindexIndexed == pindexBest)
+            condIndexSync.wait(lock);
+    }
+}
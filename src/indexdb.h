@@ -0,0 +1,153 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXDB_H
+#define BITCOIN_INDEXDB_H
+
+#include "dbwrapper.h"
+#include "spentindex.h"
+#include "validationinterface.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockTreeDB;
+class CBlockUndo;
+class uint256;
+
+/**
+ * Cursor over the entries of one address in the address index or the
+ * address unspent index, in database key order.
+ */
+template <typename K, typename V>
+class CAddressCursor
+{
+public:
+    CAddressCursor(CDBIterator* pcursorIn, char chPrefixIn, unsigned int typeIn, const uint160& hashBytesIn) :
+        pcursor(pcursorIn), chPrefix(chPrefixIn), type(typeIn), hashBytes(hashBytesIn), fValid(false) {}
+
+    /** Position the cursor at the first entry of the address at or after start */
+    template <typename S> void Seek(const S& start) {
+        pcursor->Seek(std::make_pair(chPrefix, start));
+        Load();
+    }
+
+    bool Valid() const { return fValid; }
+    const K& GetKey() const { return key; }
+    const V& GetValue() const { return value; }
+
+    void Next() {
+        pcursor->Next();
+        Load();
+    }
+
+private:
+    void Load() {
+        std::pair<char, K> entry;
+        fValid = pcursor->Valid() && pcursor->GetKey(entry) && entry.first == chPrefix &&
+                 entry.second.type == type && entry.second.hashBytes == hashBytes && pcursor->GetValue(value);
+        if (fValid)
+            key = entry.second;
+    }
+
+    std::unique_ptr<CDBIterator> pcursor;
+    char chPrefix;
+    unsigned int type;
+    uint160 hashBytes;
+    bool fValid;
+    K key;
+    V value;
+};
+
+class CAddressIndexCursor : public CAddressCursor<CAddressIndexKey, CAmount>
+{
+public:
+    using CAddressCursor::CAddressCursor;
+};
+
+class CAddressUnspentCursor : public CAddressCursor<CAddressUnspentKey, CAddressUnspentValue>
+{
+public:
+    using CAddressCursor::CAddressCursor;
+};
+
+/**
+ * Access to the database of the address, spent and timestamp indexes
+ * (indexes/).
+ *
+ * The indexes are not written while a block is connected. The index thread
+ * applies whole blocks afterwards, each in one batch together with the block
+ * the database is synced to, so after a restart it continues from there.
+ */
+class CIndexDB : public CDBWrapper
+{
+public:
+    CIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbopts = CDBOptions());
+private:
+    CIndexDB(const CIndexDB&);
+    void operator=(const CIndexDB&);
+public:
+    /** Block the indexes are synced to; false for a new database */
+    bool ReadBestBlock(uint256 &hash);
+    /** Add the entries of a block of the active chain, read back with its undo data */
+    bool ConnectBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex);
+    /** Remove the entries of a block that left the active chain */
+    bool DisconnectBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex);
+    /** Take over the indexes of older versions, which kept them in the block tree database */
+    bool Upgrade(CBlockTreeDB &blocktree, const uint256 &hashBestChain);
+
+    bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+    bool ReadAddressUnspentIndex(uint160 addressHash, int type,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool ReadAddressIndex(uint160 addressHash, int type,
+                          std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                          int start = 0, int end = 0);
+    CAddressIndexCursor *AddressIndexCursor(uint160 addressHash, int type);
+    CAddressUnspentCursor *AddressUnspentCursor(uint160 addressHash, int type);
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    bool UpgradeAddressBalanceIndex();
+    bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+private:
+    bool WriteBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex, bool fDisconnect);
+    void AddressIndexToBatch(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase);
+    void UpdateAddressBalanceIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase);
+    int FindLastAddressIndexHeight(uint160 addressHash, int type, int beforeHeight);
+};
+
+/** The index database, NULL unless -addressindex, -spentindex or -timestampindex is enabled */
+extern CIndexDB *pindexdb;
+
+/** Wakes the index thread whenever the active chain tip changes */
+class CIndexSyncNotifier : public CValidationInterface
+{
+public:
+    virtual ~CIndexSyncNotifier() {}
+protected:
+    // CValidationInterface
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+};
+
+/** Open pindexdb and find where the index thread has to continue from. Called with cs_main held. */
+bool InitIndexDB(size_t nCacheSize, bool fWipe, const CDBOptions& dbopts);
+/** Close pindexdb once the index thread has stopped */
+void ShutdownIndexDB();
+/** Run the index thread: keep pindexdb in step with the active chain */
+void ThreadIndexSync();
+/**
+ * Wait until the indexes cover the active chain tip as it is now, so that a
+ * query sees the blocks connected before it. Returns false at once while the
+ * index is still catching up after startup, in which case the query has to be
+ * refused. Must not be called with cs_main held.
+ */
+bool WaitForIndexSync();
+
+#endif // BITCOIN_INDEXDB_H
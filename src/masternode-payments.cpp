@@ -483,23 +483,29 @@ bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payeeRet) con
 // Is this masternode scheduled to get paid soon?
 // -- Only look ahead up to 8 blocks to allow for propagation of the latest 2 blocks of votes
 bool CMasternodePayments::IsScheduled(const masternode_info_t& mnInfo, int nNotBlockHeight) const
+{
+    std::set<CScript> setPayees;
+    GetScheduledPayees(nNotBlockHeight, setPayees);
+
+    return setPayees.count(GetScriptForDestination(mnInfo.pubKeyCollateralAddress.GetID()));
+}
+
+// Everyone IsScheduled() would return true for, collected at once for callers checking the whole list
+void CMasternodePayments::GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayeesRet) const
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    if(!masternodeSync.IsMasternodeListSynced()) return false;
+    setPayeesRet.clear();
 
-    CScript mnpayee;
-    mnpayee = GetScriptForDestination(mnInfo.pubKeyCollateralAddress.GetID());
+    if(!masternodeSync.IsMasternodeListSynced()) return;
 
     CScript payee;
     for(int64_t h = nCachedBlockHeight; h <= nCachedBlockHeight + 8; h++){
         if(h == nNotBlockHeight) continue;
-        if(GetBlockPayee(h, payee) && mnpayee == payee) {
-            return true;
+        if(GetBlockPayee(h, payee)) {
+            setPayeesRet.insert(payee);
         }
     }
-
-    return false;
 }
 
 bool CMasternodePayments::AddOrUpdatePaymentVote(const CMasternodePaymentVote& vote)
@@ -530,6 +536,45 @@ bool CMasternodePayments::HasVerifiedPaymentVote(const uint256& hashIn) const
     return it != mapMasternodePaymentVotes.end() && it->second.IsVerified();
 }
 
+bool CMasternodePayments::HasPaymentVote(const uint256& hashIn) const
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+    return mapMasternodePaymentVotes.count(hashIn);
+}
+
+bool CMasternodePayments::GetPaymentVote(const uint256& hashIn, CMasternodePaymentVote& voteRet) const
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+    const auto it = mapMasternodePaymentVotes.find(hashIn);
+    if (it == mapMasternodePaymentVotes.end())
+        return false;
+
+    voteRet = it->second;
+    return true;
+}
+
+bool CMasternodePayments::HasPayeesForHeight(int nBlockHeight) const
+{
+    LOCK(cs_mapMasternodeBlocks);
+    return mapMasternodeBlocks.count(nBlockHeight);
+}
+
+bool CMasternodePayments::GetBlockVoteHashes(int nBlockHeight, std::vector<uint256>& vecVoteHashesRet) const
+{
+    LOCK(cs_mapMasternodeBlocks);
+    const auto it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it == mapMasternodeBlocks.end())
+        return false;
+
+    LOCK(cs_vecPayees);
+    vecVoteHashesRet.clear();
+    for (const auto& payee : it->second.vecPayees) {
+        std::vector<uint256> vecVoteHashes = payee.GetVoteHashes();
+        vecVoteHashesRet.insert(vecVoteHashesRet.end(), vecVoteHashes.begin(), vecVoteHashes.end());
+    }
+    return true;
+}
+
 void CMasternodeBlockPayees::AddPayee(const CMasternodePaymentVote& vote)
 {
     LOCK(cs_vecPayees);
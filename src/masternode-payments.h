@@ -206,6 +206,10 @@ public:
 
     bool AddOrUpdatePaymentVote(const CMasternodePaymentVote& vote);
     bool HasVerifiedPaymentVote(const uint256& hashIn) const;
+    bool HasPaymentVote(const uint256& hashIn) const;
+    bool GetPaymentVote(const uint256& hashIn, CMasternodePaymentVote& voteRet) const;
+    bool HasPayeesForHeight(int nBlockHeight) const;
+    bool GetBlockVoteHashes(int nBlockHeight, std::vector<uint256>& vecVoteHashesRet) const;
     bool ProcessBlock(int nBlockHeight, CConnman& connman);
     void CheckBlockVotes(int nBlockHeight);
 
@@ -216,6 +220,7 @@ public:
     bool GetBlockPayee(int nBlockHeight, CScript& payeeRet) const;
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight) const;
     bool IsScheduled(const masternode_info_t& mnInfo, int nNotBlockHeight) const;
+    void GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayeesRet) const;
 
     bool UpdateLastVote(const CMasternodePaymentVote& vote);
 
@@ -570,7 +570,7 @@ bool CMasternodeBroadcast::CheckOutpoint(int& nDos)
                 Params().GetConsensus().nMasternodeMinimumConfirmations, outpoint.ToStringShort());
         // UTXO is legit but has not enough confirmations.
         // Maybe we miss few blocks, let this mnb be checked again later.
-        mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
+        mnodeman.RemoveSeenMasternodeBroadcast(GetHash());
         return false;
     }
 
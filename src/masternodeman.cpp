@@ -27,15 +27,6 @@ CMasternodeMan mnodeman;
 const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-8";
 const int CMasternodeMan::LAST_PAID_SCAN_BLOCKS = 100;
 
-struct CompareLastPaidBlock
-{
-    bool operator()(const std::pair<int, const CMasternode*>& t1,
-                    const std::pair<int, const CMasternode*>& t2) const
-    {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->outpoint < t2.second->outpoint);
-    }
-};
-
 struct CompareScoreMN
 {
     bool operator()(const std::pair<arith_uint256, const CMasternode*>& t1,
@@ -58,6 +49,11 @@ struct CompareByAddr
 CMasternodeMan::CMasternodeMan():
     cs(),
     mapMasternodes(),
+    setPaymentQueue(),
+    fPaymentQueueDirty(false),
+    mapCollateralHeight(),
+    hashCollateralHeightTip(),
+    mapScoresCache(SCORES_CACHE_SIZE),
     mAskedUsForMasternodeList(),
     mWeAskedForMasternodeList(),
     mWeAskedForMasternodeListEntry(),
@@ -82,6 +78,8 @@ bool CMasternodeMan::Add(CMasternode &mn)
 
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     mapMasternodes[mn.outpoint] = mn;
+    setPaymentQueue.insert(std::make_pair(mn.GetLastPaidBlock(), mn.outpoint));
+    mapScoresCache.Clear();
     fMasternodesAdded = true;
     return true;
 }
@@ -203,6 +201,9 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
 
                 // and finally remove it from the list
                 it->second.FlagGovernanceItemsAsDirty();
+                setPaymentQueue.erase(std::make_pair(it->second.GetLastPaidBlock(), it->first));
+                mapCollateralHeight.erase(it->first);
+                mapScoresCache.Clear();
                 mapMasternodes.erase(it++);
                 fMasternodesRemoved = true;
             } else {
@@ -360,6 +361,11 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     mapMasternodes.clear();
+    setPaymentQueue.clear();
+    fPaymentQueueDirty = false;
+    mapCollateralHeight.clear();
+    hashCollateralHeightTip.SetNull();
+    mapScoresCache.Clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -503,6 +509,63 @@ bool CMasternodeMan::Has(const COutPoint& outpoint)
     return mapMasternodes.find(outpoint) != mapMasternodes.end();
 }
 
+bool CMasternodeMan::HasSeenMasternodeBroadcast(const uint256& hash)
+{
+    LOCK(cs);
+    return mapSeenMasternodeBroadcast.count(hash);
+}
+
+bool CMasternodeMan::GetSeenMasternodeBroadcast(const uint256& hash, CMasternodeBroadcast& mnbRet)
+{
+    LOCK(cs);
+    auto it = mapSeenMasternodeBroadcast.find(hash);
+    if (it == mapSeenMasternodeBroadcast.end()) {
+        return false;
+    }
+    mnbRet = it->second.second;
+    return true;
+}
+
+void CMasternodeMan::RemoveSeenMasternodeBroadcast(const uint256& hash)
+{
+    LOCK(cs);
+    mapSeenMasternodeBroadcast.erase(hash);
+}
+
+bool CMasternodeMan::HasSeenMasternodePing(const uint256& hash)
+{
+    LOCK(cs);
+    return mapSeenMasternodePing.count(hash);
+}
+
+bool CMasternodeMan::GetSeenMasternodePing(const uint256& hash, CMasternodePing& mnpRet)
+{
+    LOCK(cs);
+    auto it = mapSeenMasternodePing.find(hash);
+    if (it == mapSeenMasternodePing.end()) {
+        return false;
+    }
+    mnpRet = it->second;
+    return true;
+}
+
+bool CMasternodeMan::HasSeenMasternodeVerification(const uint256& hash)
+{
+    LOCK(cs);
+    return mapSeenMasternodeVerification.count(hash);
+}
+
+bool CMasternodeMan::GetSeenMasternodeVerification(const uint256& hash, CMasternodeVerification& mnvRet)
+{
+    LOCK(cs);
+    auto it = mapSeenMasternodeVerification.find(hash);
+    if (it == mapSeenMasternodeVerification.end()) {
+        return false;
+    }
+    mnvRet = it->second;
+    return true;
+}
+
 //
 // Deterministically select the oldest/best masternode to pay on the network
 //
@@ -511,6 +574,38 @@ bool CMasternodeMan::GetNextMasternodeInQueueForPayment(bool fFilterSigTime, int
     return GetNextMasternodeInQueueForPayment(nCachedBlockHeight, fFilterSigTime, nCountRet, mnInfoRet);
 }
 
+void CMasternodeMan::RebuildPaymentQueue()
+{
+    LOCK(cs);
+
+    setPaymentQueue.clear();
+    for (const auto& mnpair : mapMasternodes) {
+        setPaymentQueue.insert(std::make_pair(mnpair.second.GetLastPaidBlock(), mnpair.first));
+    }
+    fPaymentQueueDirty = false;
+}
+
+int CMasternodeMan::GetCollateralConfirmations(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    if(!chainActive.Tip()) return -1;
+
+    // UTXO set only changes together with the tip, drop heights looked up for the previous one
+    if(hashCollateralHeightTip != chainActive.Tip()->GetBlockHash()) {
+        mapCollateralHeight.clear();
+        hashCollateralHeightTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    auto it = mapCollateralHeight.find(outpoint);
+    if(it == mapCollateralHeight.end()) {
+        it = mapCollateralHeight.emplace(outpoint, GetUTXOHeight(outpoint)).first;
+    }
+    // -1 means UTXO is yet unknown or already spent
+    return it->second > -1 ? chainActive.Height() - it->second + 1 : -1;
+}
+
 bool CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool fFilterSigTime, int& nCountRet, masternode_info_t& mnInfoRet)
 {
     mnInfoRet = masternode_info_t();
@@ -524,62 +619,79 @@ bool CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool f
     // Need LOCK2 here to ensure consistent locking order because the GetBlockHash call below locks cs_main
     LOCK2(cs_main,cs);
 
-    std::vector<std::pair<int, const CMasternode*> > vecMasternodeLastPaid;
+    if(fPaymentQueueDirty || setPaymentQueue.size() != mapMasternodes.size()) {
+        RebuildPaymentQueue();
+    }
+
+    int nMnCount = CountMasternodes();
+
+    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
+    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
+    //  -- (chance per block * chances before IsScheduled will fire)
+    int nTenthNetwork = std::max(nMnCount/10, 1);
+
+    // everyone who is in the list up to 8 entries ahead of current block (see CMasternodePayments::IsScheduled)
+    std::set<CScript> setScheduledPayees;
+    mnpayments.GetScheduledPayees(nBlockHeight, setScheduledPayees);
+
+    int nMinProtocol = mnpayments.GetMinMasternodePaymentsProto();
+    int64_t nAdjustedTime = GetAdjustedTime();
 
     /*
-        Make a vector with all of the last paid times
+        Walk the payment queue (sorted low to high by last paid block), count all eligible
+        masternodes and keep the oldest tenth of them
     */
 
-    int nMnCount = CountMasternodes();
+    std::vector<const CMasternode*> vecOldestMasternodes;
 
-    for (const auto& mnpair : mapMasternodes) {
-        if(!mnpair.second.IsValidForPayment()) continue;
+    for (const auto& queuepair : setPaymentQueue) {
+        auto it = mapMasternodes.find(queuepair.second);
+        if(it == mapMasternodes.end() || it->second.GetLastPaidBlock() != queuepair.first) {
+            // queue is out of sync with the list, rebuild it and start over
+            fPaymentQueueDirty = true;
+            return GetNextMasternodeInQueueForPayment(nBlockHeight, fFilterSigTime, nCountRet, mnInfoRet);
+        }
+        const CMasternode& mn = it->second;
+
+        if(!mn.IsValidForPayment()) continue;
 
         //check protocol version
-        if(mnpair.second.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
+        if(mn.nProtocolVersion < nMinProtocol) continue;
 
         //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if(mnpayments.IsScheduled(mnpair.second, nBlockHeight)) continue;
+        if(!setScheduledPayees.empty() && setScheduledPayees.count(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()))) continue;
 
         //it's too new, wait for a cycle
-        if(fFilterSigTime && mnpair.second.sigTime + (nMnCount*2.6*60) > GetAdjustedTime()) continue;
+        if(fFilterSigTime && mn.sigTime + (nMnCount*2.6*60) > nAdjustedTime) continue;
 
         //make sure it has at least as many confirmations as there are masternodes
-        if(GetUTXOConfirmations(mnpair.first) < nMnCount) continue;
+        if(GetCollateralConfirmations(mn.outpoint) < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mnpair.second.GetLastPaidBlock(), &mnpair.second));
+        if((int)vecOldestMasternodes.size() < nTenthNetwork) {
+            vecOldestMasternodes.push_back(&mn);
+        }
+        nCountRet++;
     }
 
-    nCountRet = (int)vecMasternodeLastPaid.size();
-
     //when the network is in the process of upgrading, don't penalize nodes that recently restarted
     if(fFilterSigTime && nCountRet < nMnCount/3)
         return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCountRet, mnInfoRet);
 
-    // Sort them low to high
-    sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), CompareLastPaidBlock());
-
     uint256 blockHash;
     if(!GetBlockHash(blockHash, nBlockHeight - 101)) {
         LogPrintf("CMasternode::GetNextMasternodeInQueueForPayment -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", nBlockHeight - 101);
         return false;
     }
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
-    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
-    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
-    //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = nMnCount/10;
-    int nCountTenth = 0;
+
     arith_uint256 nHighest = 0;
     const CMasternode *pBestMasternode = NULL;
-    for (const auto& s : vecMasternodeLastPaid) {
-        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+    for (const auto& pmn : vecOldestMasternodes) {
+        arith_uint256 nScore = pmn->CalculateScore(blockHash);
         if(nScore > nHighest){
             nHighest = nScore;
-            pBestMasternode = s.second;
+            pBestMasternode = pmn;
         }
-        nCountTenth++;
-        if(nCountTenth >= nTenthNetwork) break;
     }
     if (pBestMasternode) {
         mnInfoRet = pBestMasternode->GetInfo();
@@ -630,9 +742,9 @@ masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<COutPoint
     return masternode_info_t();
 }
 
-bool CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, CMasternodeMan::score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol)
+bool CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, CMasternodeMan::scores_ptr_t& pScoresRet, int nMinProtocol)
 {
-    vecMasternodeScoresRet.clear();
+    pScoresRet.reset();
 
     if (!masternodeSync.IsMasternodeListSynced())
         return false;
@@ -642,15 +754,31 @@ bool CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, CMasternodeM
     if (mapMasternodes.empty())
         return false;
 
+    std::pair<uint256, int> key = std::make_pair(nBlockHash, nMinProtocol);
+    if (mapScoresCache.Get(key, pScoresRet))
+        return !pScoresRet->vecOutpoints.empty();
+
     // calculate scores
+    score_pair_vec_t vecMasternodeScores;
     for (const auto& mnpair : mapMasternodes) {
         if (mnpair.second.nProtocolVersion >= nMinProtocol) {
-            vecMasternodeScoresRet.push_back(std::make_pair(mnpair.second.CalculateScore(nBlockHash), &mnpair.second));
+            vecMasternodeScores.push_back(std::make_pair(mnpair.second.CalculateScore(nBlockHash), &mnpair.second));
         }
     }
 
-    sort(vecMasternodeScoresRet.rbegin(), vecMasternodeScoresRet.rend(), CompareScoreMN());
-    return !vecMasternodeScoresRet.empty();
+    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+
+    std::shared_ptr<CMasternodeScores> pScores = std::make_shared<CMasternodeScores>();
+    pScores->vecOutpoints.reserve(vecMasternodeScores.size());
+    pScores->mapRanks.reserve(vecMasternodeScores.size());
+    for (const auto& scorePair : vecMasternodeScores) {
+        pScores->vecOutpoints.push_back(scorePair.second->outpoint);
+        pScores->mapRanks.emplace(scorePair.second->outpoint, (int)pScores->vecOutpoints.size());
+    }
+
+    pScoresRet = pScores;
+    mapScoresCache.Insert(key, pScoresRet);
+    return !pScoresRet->vecOutpoints.empty();
 }
 
 bool CMasternodeMan::GetMasternodeRank(const COutPoint& outpoint, int& nRankRet, int nBlockHeight, int nMinProtocol)
@@ -669,20 +797,16 @@ bool CMasternodeMan::GetMasternodeRank(const COutPoint& outpoint, int& nRankRet,
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+    scores_ptr_t pScores;
+    if (!GetMasternodeScores(nBlockHash, pScores, nMinProtocol))
         return false;
 
-    int nRank = 0;
-    for (const auto& scorePair : vecMasternodeScores) {
-        nRank++;
-        if(scorePair.second->outpoint == outpoint) {
-            nRankRet = nRank;
-            return true;
-        }
-    }
+    auto it = pScores->mapRanks.find(outpoint);
+    if (it == pScores->mapRanks.end())
+        return false;
 
-    return false;
+    nRankRet = it->second;
+    return true;
 }
 
 bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMasternodeRanksRet, int nBlockHeight, int nMinProtocol)
@@ -701,14 +825,14 @@ bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMast
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+    scores_ptr_t pScores;
+    if (!GetMasternodeScores(nBlockHash, pScores, nMinProtocol))
         return false;
 
     int nRank = 0;
-    for (const auto& scorePair : vecMasternodeScores) {
+    for (const auto& outpoint : pScores->vecOutpoints) {
         nRank++;
-        vecMasternodeRanksRet.push_back(std::make_pair(nRank, *scorePair.second));
+        vecMasternodeRanksRet.push_back(std::make_pair(nRank, mapMasternodes.at(outpoint)));
     }
 
     return true;
@@ -1375,11 +1499,14 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
 
     std::string strError;
 
-    if(mapSeenMasternodeVerification.find(mnv.GetHash()) != mapSeenMasternodeVerification.end()) {
-        // we already have one
-        return;
+    {
+        LOCK(cs);
+        if(mapSeenMasternodeVerification.find(mnv.GetHash()) != mapSeenMasternodeVerification.end()) {
+            // we already have one
+            return;
+        }
+        mapSeenMasternodeVerification[mnv.GetHash()] = mnv;
     }
-    mapSeenMasternodeVerification[mnv.GetHash()] = mnv;
 
     // we don't care about history
     if(mnv.nBlockHeight < nCachedBlockHeight - MAX_POSE_BLOCKS) {
@@ -1558,7 +1685,13 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
         CMasternode* pmn = Find(mnb.outpoint);
         if(pmn) {
             CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-            if(!mnb.Update(pmn, nDos, connman)) {
+            int nProtocolVersionOld = pmn->nProtocolVersion;
+            bool fUpdated = mnb.Update(pmn, nDos, connman);
+            if(pmn->nProtocolVersion != nProtocolVersionOld) {
+                // scores are only calculated for masternodes with a recent enough protocol
+                mapScoresCache.Clear();
+            }
+            if(!fUpdated) {
                 LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- Update() failed, masternode=%s\n", mnb.outpoint.ToStringShort());
                 return false;
             }
@@ -1611,7 +1744,13 @@ void CMasternodeMan::UpdateLastPaid(const CBlockIndex* pindex)
                             nCachedBlockHeight, nLastRunBlockHeight, nMaxBlocksToScanBack);
 
     for (auto& mnpair : mapMasternodes) {
+        int nLastPaidBlockOld = mnpair.second.GetLastPaidBlock();
         mnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+        if(mnpair.second.GetLastPaidBlock() != nLastPaidBlockOld) {
+            // move it to its new place in the payment queue
+            setPaymentQueue.erase(std::make_pair(nLastPaidBlockOld, mnpair.first));
+            setPaymentQueue.insert(std::make_pair(mnpair.second.GetLastPaidBlock(), mnpair.first));
+        }
     }
 
     nLastRunBlockHeight = nCachedBlockHeight;
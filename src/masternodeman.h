@@ -5,9 +5,13 @@
 #ifndef MASTERNODEMAN_H
 #define MASTERNODEMAN_H
 
+#include "cachemap.h"
 #include "masternode.h"
 #include "sync.h"
 
+#include <memory>
+#include <unordered_map>
+
 class CMasternodeMan;
 class CConnman;
 
@@ -39,6 +43,16 @@ private:
     static const int MNB_RECOVERY_WAIT_SECONDS      = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS     = 3 * 60 * 60;
 
+    static const int SCORES_CACHE_SIZE              = 10;
+
+    /// Masternodes ordered by score for one block hash, highest first, and the rank of each one
+    struct CMasternodeScores
+    {
+        std::vector<COutPoint> vecOutpoints;
+        std::unordered_map<COutPoint, int, SaltedOutpointHasher> mapRanks;
+    };
+    typedef std::shared_ptr<const CMasternodeScores> scores_ptr_t;
+
 
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -48,6 +62,15 @@ private:
 
     // map to hold all MNs
     std::map<COutPoint, CMasternode> mapMasternodes;
+    // all MNs ordered by last paid block (then outpoint), i.e. in payment queue order
+    std::set<std::pair<int, COutPoint> > setPaymentQueue;
+    // set when setPaymentQueue has to be rebuilt from mapMasternodes
+    bool fPaymentQueueDirty;
+    // collateral heights (-1 if unknown or spent) as of the chain tip hashCollateralHeightTip
+    std::map<COutPoint, int> mapCollateralHeight;
+    uint256 hashCollateralHeightTip;
+    // GetMasternodeScores results for the latest (block hash, min protocol) pairs, cleared when the list changes
+    CacheMap<std::pair<uint256, int>, scores_ptr_t> mapScoresCache;
     // who's asked for the Masternode list and the last time
     std::map<CService, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -80,7 +103,11 @@ private:
     /// Find an entry
     CMasternode* Find(const COutPoint& outpoint);
 
-    bool GetMasternodeScores(const uint256& nBlockHash, score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol = 0);
+    bool GetMasternodeScores(const uint256& nBlockHash, scores_ptr_t& pScoresRet, int nMinProtocol = 0);
+
+    void RebuildPaymentQueue();
+    /// Same as GetUTXOConfirmations but remembers collateral heights until the tip changes
+    int GetCollateralConfirmations(const COutPoint& outpoint);
 
     void SyncSingle(CNode* pnode, const COutPoint& outpoint, CConnman& connman);
     void SyncAll(CNode* pnode, CConnman& connman);
@@ -123,6 +150,10 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+        if(ser_action.ForRead()) {
+            fPaymentQueueDirty = true;
+            mapScoresCache.Clear();
+        }
         if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
             Clear();
         }
@@ -206,7 +237,16 @@ public:
 
     /// Perform complete check and only then update masternode list and maps using provided CMasternodeBroadcast
     bool CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBroadcast mnb, int& nDos, CConnman& connman);
-    bool IsMnbRecoveryRequested(const uint256& hash) { return mMnbRecoveryRequests.count(hash); }
+    bool IsMnbRecoveryRequested(const uint256& hash) { LOCK(cs); return mMnbRecoveryRequests.count(hash); }
+
+    /// Versions of the seen maps lookups that are safe to use from outside the class
+    bool HasSeenMasternodeBroadcast(const uint256& hash);
+    bool GetSeenMasternodeBroadcast(const uint256& hash, CMasternodeBroadcast& mnbRet);
+    void RemoveSeenMasternodeBroadcast(const uint256& hash);
+    bool HasSeenMasternodePing(const uint256& hash);
+    bool GetSeenMasternodePing(const uint256& hash, CMasternodePing& mnpRet);
+    bool HasSeenMasternodeVerification(const uint256& hash);
+    bool GetSeenMasternodeVerification(const uint256& hash, CMasternodeVerification& mnvRet);
 
     void UpdateLastPaid(const CBlockIndex* pindex);
 
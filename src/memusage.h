@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -181,6 +182,17 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, std::equal_to<X>, PoolAllocator<std::pair<const X, Y> > >& m)
+{
+    const PoolResource* resource = m.get_allocator().GetResource();
+    if (resource == nullptr) {
+        return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
+    }
+    // Nodes live in the arena's chunks, which are only released all at once
+    return MallocUsage(PoolResource::CHUNK_SIZE_BYTES) * resource->NumChunks() + MallocUsage(resource->LargeBytes());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
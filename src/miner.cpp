@@ -154,12 +154,142 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockSize = nBlockSize;
     LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
 
+    scriptCoinbase = scriptPubKeyIn;
+    FillCoinbase(pindexPrev);
+
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nNonce         = 0;
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint("bench", "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+
+    // Keep our own copy for UpdateNewBlock
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::UpdateNewBlock(const std::vector<uint256>& vNewTxids)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    if (!pblocktemplate)
+        return nullptr;
+
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (pindexPrev->GetBlockHash() != pblock->hashPrevBlock) {
+        pblocktemplate.reset();
+        return nullptr;
+    }
+
+    // Transactions in the block that left the mempool (expired, evicted or
+    // conflicted) leave dangling entries in inBlock, start over in that case.
+    // Look them up again instead of comparing with inBlock for the same reason.
+    CTxMemPool::setEntries inBlockNew;
+    for (size_t i = 1; i < pblock->vtx.size(); ++i) {
+        CTxMemPool::txiter it = mempool.mapTx.find(pblock->vtx[i]->GetHash());
+        if (it == mempool.mapTx.end()) {
+            pblocktemplate.reset();
+            return nullptr;
+        }
+        inBlockNew.insert(it);
+    }
+    inBlock.swap(inBlockNew);
+
+    // New transactions that are still there, best ancestor fee rate first
+    std::vector<CTxMemPool::txiter> vNewEntries;
+    for (const auto& txid : vNewTxids) {
+        CTxMemPool::txiter it = mempool.mapTx.find(txid);
+        if (it != mempool.mapTx.end() && !inBlock.count(it))
+            vNewEntries.push_back(it);
+    }
+    std::sort(vNewEntries.begin(), vNewEntries.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    });
+
+    // Same checks as in addPackageTxs, just for the packages of the new transactions
+    int nPackagesSelected = 0;
+    for (const auto& iter : vNewEntries) {
+        // Already added as an ancestor of another new transaction
+        if (inBlock.count(iter))
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        unsigned int packageSigOps = 0;
+        for (const auto& it : ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOps += it->GetSigOpCount();
+        }
+
+        if (packageFees < blockMinFeeRate.GetFee(packageSize))
+            continue;
+        if (!TestPackage(packageSize, packageSigOps))
+            continue;
+        if (!TestPackageTransactions(ancestors))
+            continue;
+
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
+        for (size_t i=0; i<sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+        }
+        ++nPackagesSelected;
+    }
+
+    int64_t nTime1 = GetTimeMicros();
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+
+    // Only the coinbase amounts change with the fees, the transactions themselves
+    // passed the same checks as during CreateNewBlock. Validate the block again
+    // only if the masternode or superblock payees are different now.
+    CTxOut txoutMasternodeOld = pblock->txoutMasternode;
+    std::vector<CTxOut> voutSuperblockOld = pblock->voutSuperblock;
+    FillCoinbase(pindexPrev);
+
+    bool fPayeesChanged = pblock->txoutMasternode.scriptPubKey != txoutMasternodeOld.scriptPubKey ||
+                          pblock->voutSuperblock != voutSuperblockOld;
+    if (fPayeesChanged) {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            LogPrintf("BlockAssembler::UpdateNewBlock -- TestBlockValidity failed: %s\n", FormatStateMessage(state));
+            pblocktemplate.reset();
+            return nullptr;
+        }
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint("bench", "UpdateNewBlock() packages: %.2fms (%d new txs, %d packages), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), vNewEntries.size(), nPackagesSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+void BlockAssembler::FillCoinbase(const CBlockIndex* pindexPrev)
+{
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
     coinbaseTx.vin.resize(1);
     coinbaseTx.vin[0].prevout.SetNull();
     coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].scriptPubKey = scriptCoinbase;
 
     // NOTE: unlike in bitcoin, we need to pass PREVIOUS block height here
     CAmount blockReward = nFees + GetBlockSubsidy(pindexPrev->nBits, pindexPrev->nHeight, Params().GetConsensus());
@@ -170,29 +300,15 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     // Update coinbase transaction with additional info about masternode and governance payments,
     // get some info back to pass to getblocktemplate
+    pblock->txoutMasternode = CTxOut();
+    pblock->voutSuperblock.clear();
     FillBlockPayments(coinbaseTx, nHeight, blockReward, pblock->txoutMasternode, pblock->voutSuperblock);
     // LogPrintf("CreateNewBlock -- nBlockHeight %d blockReward %lld txoutMasternode %s coinbaseTx %s",
     //             nHeight, blockReward, pblock->txoutMasternode.ToString(), coinbaseTx.ToString());
 
     pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
     pblocktemplate->vTxFees[0] = -nFees;
-
-    // Fill in header
-    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce         = 0;
     pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
-    }
-    int64_t nTime2 = GetTimeMicros();
-
-    LogPrint("bench", "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
-
-    return std::move(pblocktemplate);
 }
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
@@ -588,3 +704,171 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+CBlockTemplateBuilder blockTemplateBuilder;
+
+CBlockTemplateBuilder::CBlockTemplateBuilder() :
+    passembler(),
+    pblocktemplate(),
+    pindexPrev(NULL),
+    nTransactionsUpdated(0),
+    nTimeBuilt(0),
+    nTimeUpdated(0),
+    nBuildTimeMicros(0),
+    nTimeLastRequest(0),
+    connNewTransaction(),
+    vNewTxids()
+{}
+
+void CBlockTemplateBuilder::Build(const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    // Clear the template so future calls make a new block, despite any failures from here on
+    pblocktemplate.reset();
+    {
+        LOCK(cs_vNewTxids);
+        vNewTxids.clear();
+    }
+
+    // Store the chainActive.Tip() used before CreateNewBlock, to avoid races
+    unsigned int nTransactionsUpdatedNew = mempool.GetTransactionsUpdated();
+    const CBlockIndex* pindexPrevNew = chainActive.Tip();
+    int64_t nTimeStart = GetTimeMicros();
+
+    CScript scriptDummy = CScript() << OP_TRUE;
+    passembler.reset(new BlockAssembler(chainparams));
+    std::unique_ptr<CBlockTemplate> pblocktemplateNew = passembler->CreateNewBlock(scriptDummy);
+    if (!pblocktemplateNew)
+        return;
+
+    // Need to update only after we know CreateNewBlock succeeded
+    pblocktemplate = std::move(pblocktemplateNew);
+    pindexPrev = pindexPrevNew;
+    nTransactionsUpdated = nTransactionsUpdatedNew;
+    nTimeBuilt = nTimeUpdated = GetTime();
+    nBuildTimeMicros = GetTimeMicros() - nTimeStart;
+}
+
+void CBlockTemplateBuilder::Refresh(const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    if (!pblocktemplate || pindexPrev != chainActive.Tip()) {
+        Build(chainparams);
+        return;
+    }
+
+    if (mempool.GetTransactionsUpdated() == nTransactionsUpdated)
+        return;
+
+    // Assemble from scratch every now and then so that better paying
+    // transactions can take the place of the ones added since
+    if (GetTime() - nTimeBuilt > BLOCK_TEMPLATE_MAX_AGE) {
+        Build(chainparams);
+        return;
+    }
+
+    // Otherwise just add the new transactions. Nothing can enter the mempool
+    // while we hold cs_main, so vNewTxids matches the update counter.
+    unsigned int nTransactionsUpdatedNew = mempool.GetTransactionsUpdated();
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::vector<uint256> vTxids;
+    {
+        LOCK(cs_vNewTxids);
+        vTxids.swap(vNewTxids);
+    }
+
+    std::unique_ptr<CBlockTemplate> pblocktemplateNew = passembler->UpdateNewBlock(vTxids);
+    if (!pblocktemplateNew) {
+        Build(chainparams);
+        return;
+    }
+
+    pblocktemplate = std::move(pblocktemplateNew);
+    nTransactionsUpdated = nTransactionsUpdatedNew;
+    nTimeUpdated = GetTime();
+    nBuildTimeMicros = GetTimeMicros() - nTimeStart;
+}
+
+void CBlockTemplateBuilder::TransactionAddedToMempool(const CTransactionRef& ptx)
+{
+    LOCK(cs_vNewTxids);
+    vNewTxids.push_back(ptx->GetHash());
+}
+
+std::shared_ptr<const CBlockTemplate> CBlockTemplateBuilder::Get(const CChainParams& chainparams, const CBlockIndex*& pindexPrevRet, unsigned int& nTransactionsUpdatedRet)
+{
+    LOCK2(cs_main, cs);
+
+    nTimeLastRequest = GetTime();
+    if (!connNewTransaction.connected()) {
+        connNewTransaction = mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateBuilder::TransactionAddedToMempool, this, _1));
+        // We didn't see what came in before
+        pblocktemplate.reset();
+    }
+
+    Refresh(chainparams);
+
+    pindexPrevRet = pindexPrev;
+    nTransactionsUpdatedRet = nTransactionsUpdated;
+    return pblocktemplate;
+}
+
+void CBlockTemplateBuilder::Update(const CChainParams& chainparams)
+{
+    LOCK2(cs_main, cs);
+
+    if (!connNewTransaction.connected())
+        return;
+
+    // Nobody is mining on this node anymore, stop following the mempool
+    if (GetTime() - nTimeLastRequest > BLOCK_TEMPLATE_IDLE_SECONDS) {
+        connNewTransaction.disconnect();
+        pblocktemplate.reset();
+        passembler.reset();
+        LOCK(cs_vNewTxids);
+        vNewTxids.clear();
+        return;
+    }
+
+    if (IsInitialBlockDownload())
+        return;
+
+    Refresh(chainparams);
+}
+
+void CBlockTemplateBuilder::GetStats(int64_t& nAgeRet, int64_t& nBuildTimeRet) const
+{
+    LOCK(cs);
+
+    nAgeRet = pblocktemplate ? GetTime() - nTimeUpdated : -1;
+    nBuildTimeRet = pblocktemplate ? nBuildTimeMicros : -1;
+}
+
+void ThreadBlockTemplateBuilder()
+{
+    // Make this thread recognisable as the block template thread
+    RenameThread("bastoji-gbt");
+
+    const CChainParams& chainparams = Params();
+
+    while (true)
+    {
+        {
+            // Wake up for every new tip, check the mempool every second otherwise
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
+        }
+
+        try {
+            blockTemplateBuilder.Update(chainparams);
+        } catch (const std::runtime_error& e) {
+            // e.g. TestBlockValidity failing, the next request will report it
+            LogPrintf("ThreadBlockTemplateBuilder -- %s\n", e.what());
+        }
+    }
+}
@@ -24,6 +24,10 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Assemble the getblocktemplate template from scratch for new mempool transactions after this many seconds */
+static const int64_t BLOCK_TEMPLATE_MAX_AGE = 5;
+/** Stop keeping the template up to date when nobody asked for one for this many seconds */
+static const int64_t BLOCK_TEMPLATE_IDLE_SECONDS = 10 * 60;
 
 struct CBlockTemplate
 {
@@ -159,15 +163,25 @@ private:
     int lastFewTxs;
     bool blockFinished;
 
+    // Kept for UpdateNewBlock
+    CScript scriptCoinbase;
+
 public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Add transactions that entered the mempool since the last CreateNewBlock or
+      * UpdateNewBlock call to that block. Returns nullptr if the block has to be
+      * created again instead: the tip changed, a transaction in it left the
+      * mempool or the block with a new payee failed TestBlockValidity. */
+    std::unique_ptr<CBlockTemplate> UpdateNewBlock(const std::vector<uint256>& vNewTxids);
 
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Create the coinbase paying the block reward and fees to scriptCoinbase, masternode and superblock payees */
+    void FillCoinbase(const CBlockIndex* pindexPrev);
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -210,4 +224,51 @@ private:
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/**
+ * Holds the getblocktemplate template for the block on top of the current tip.
+ * Once a template was requested ThreadBlockTemplateBuilder keeps it up to date
+ * as the tip and the mempool change, so requests normally don't have to wait
+ * for CreateNewBlock. New mempool transactions are added to the template as
+ * they arrive, the block is only assembled from scratch for a new tip, when
+ * transactions in it left the mempool or every BLOCK_TEMPLATE_MAX_AGE seconds.
+ */
+class CBlockTemplateBuilder
+{
+private:
+    mutable CCriticalSection cs;
+
+    std::unique_ptr<BlockAssembler> passembler;
+    std::shared_ptr<const CBlockTemplate> pblocktemplate;
+    // Chain tip and mempool update counter the template was built for
+    const CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdated;
+    int64_t nTimeBuilt;
+    int64_t nTimeUpdated;
+    int64_t nBuildTimeMicros;
+    int64_t nTimeLastRequest;
+
+    // Transactions accepted to the mempool since the template was built or updated
+    boost::signals2::connection connNewTransaction;
+    CCriticalSection cs_vNewTxids;
+    std::vector<uint256> vNewTxids;
+
+    void Build(const CChainParams& chainparams);
+    void Refresh(const CChainParams& chainparams);
+    void TransactionAddedToMempool(const CTransactionRef& ptx);
+
+public:
+    CBlockTemplateBuilder();
+
+    /** Template for the next block, built or updated first if the tip or the mempool changed */
+    std::shared_ptr<const CBlockTemplate> Get(const CChainParams& chainparams, const CBlockIndex*& pindexPrevRet, unsigned int& nTransactionsUpdatedRet);
+    /** Update the template in advance, called by ThreadBlockTemplateBuilder */
+    void Update(const CChainParams& chainparams);
+    /** Age of the current template in seconds and how long building or updating it took in microseconds, -1 if there is none */
+    void GetStats(int64_t& nAgeRet, int64_t& nBuildTimeRet) const;
+};
+
+extern CBlockTemplateBuilder blockTemplateBuilder;
+
+void ThreadBlockTemplateBuilder();
+
 #endif // BITCOIN_MINER_H
@@ -33,6 +33,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -55,6 +56,9 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// Queued entries handed to one sendmsg(), well below IOV_MAX on Linux, the BSDs and macOS
+#define MAX_SEND_IOVECS 64
+
 // Fix for ancient MinGW versions, that don't have defined these in ws2tcpip.h.
 // Todo: Can be removed when our pull-tester is upgraded to a modern MinGW version.
 #ifdef WIN32
@@ -373,7 +377,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (socketEvents->GetMode() == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -663,12 +667,14 @@ void CNode::copyStats(CNodeStats &stats)
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
         X(nSendBytes);
+        X(nSendCalls);
     }
     {
         LOCK(cs_vRecv);
         X(mapRecvBytesPerMsgCmd);
         X(nRecvBytes);
     }
+    X(nRecvCalls);
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -705,7 +711,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -772,31 +778,130 @@ int CNode::GetSendVersion() const
 }
 
 
-int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
+namespace {
+/**
+ * Data buffers of received messages that were processed, kept for the next
+ * messages. Without them receiving a message allocates a buffer for its
+ * data. Buffers are kept in a few size classes, by the least number of bytes
+ * they have room for, with a limited number in each. They are made with an
+ * allocator that does not zero them when released, as CDataStream does for
+ * secrets, so neither kept nor dropped buffers are cleansed.
+ */
+class CRecvBufferPool
 {
-    // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+public:
+    /** Give stream a buffer with room for nSize bytes, a kept one if there is one */
+    void Take(CDataStream& stream, size_t nSize)
+    {
+        if (nSize == 0 || nSize > MAX_PROTOCOL_MESSAGE_LENGTH)
+            return;
+        int nClass = 0;
+        while (nClass < NUM_SIZE_CLASSES - 1 && SIZE_CLASSES[nClass].nSize < nSize)
+            nClass++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<CSerializeData>& vFree = vBuffers[nClass];
+            for (size_t i = vFree.size(); i-- > 0; ) {
+                if (vFree[i].capacity() >= nSize) {
+                    stream.swap(vFree[i]);
+                    vFree.erase(vFree.begin() + i);
+                    return;
+                }
+            }
+        }
+        // Make a new buffer big enough to be kept in its class afterwards.
+        // Not for blocks, which only grow as their data arrives.
+        CSerializeData vch(zero_after_free_allocator<char>(false));
+        if (nClass < NUM_SIZE_CLASSES - 1)
+            vch.reserve(SIZE_CLASSES[nClass].nSize);
+        stream.swap(vch);
+    }
 
-    memcpy(&hdrbuf[nHdrPos], pch, nCopy);
-    nHdrPos += nCopy;
+    /** Keep the buffer of stream, which is no longer needed, for later messages */
+    void Give(CDataStream& stream)
+    {
+        CSerializeData vch;
+        stream.swap(vch);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = NUM_SIZE_CLASSES - 1; i >= 0; i--) {
+            if (vch.capacity() >= SIZE_CLASSES[i].nSize) {
+                if (vBuffers[i].size() < SIZE_CLASSES[i].nMaxBuffers) {
+                    vch.clear();
+                    vBuffers[i].push_back(std::move(vch));
+                }
+                return;
+            }
+        }
+    }
 
-    // if header incomplete, exit
-    if (nHdrPos < 24)
-        return nCopy;
+private:
+    struct SizeClass
+    {
+        size_t nSize;
+        size_t nMaxBuffers;
+    };
+    static const int NUM_SIZE_CLASSES = 4;
+    static const SizeClass SIZE_CLASSES[NUM_SIZE_CLASSES];
+
+    std::mutex mutex;
+    std::vector<CSerializeData> vBuffers[NUM_SIZE_CLASSES];
+};
 
-    // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
-    }
-    catch (const std::exception&) {
-        return -1;
+const CRecvBufferPool::SizeClass CRecvBufferPool::SIZE_CLASSES[] = {
+    {1024, 256},        // transactions, votes, pings, ...
+    {16 * 1024, 64},    // inventory, headers, larger transactions
+    {256 * 1024, 8},
+    {1024 * 1024, 2},   // blocks
+};
+
+CRecvBufferPool& GetRecvBufferPool()
+{
+    // Never destroyed, messages may outlive static objects at shutdown
+    static CRecvBufferPool* pool = new CRecvBufferPool();
+    return *pool;
+}
+} // anon namespace
+
+CNetMessage::~CNetMessage()
+{
+    GetRecvBufferPool().Give(vRecv);
+}
+
+int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
+{
+    unsigned int nCopy;
+    const char* pchHeader;
+    if (nHdrPos == 0 && nBytes >= CMessageHeader::HEADER_SIZE) {
+        // the whole header was received at once, parse it where it is
+        nCopy = CMessageHeader::HEADER_SIZE;
+        nHdrPos = nCopy;
+        pchHeader = pch;
+    } else {
+        // copy data to temporary parsing buffer
+        unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
+        nCopy = std::min(nRemaining, nBytes);
+
+        memcpy(&hdrbuf[nHdrPos], pch, nCopy);
+        nHdrPos += nCopy;
+
+        // if header incomplete, exit
+        if (nHdrPos < CMessageHeader::HEADER_SIZE)
+            return nCopy;
+        pchHeader = hdrbuf;
     }
 
+    // deserialize to CMessageHeader, its fields are stored back to back
+    memcpy(hdr.pchMessageStart, pchHeader, CMessageHeader::MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, pchHeader + CMessageHeader::MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    hdr.nMessageSize = ReadLE32((const unsigned char*)pchHeader + CMessageHeader::MESSAGE_SIZE_OFFSET);
+    memcpy(hdr.pchChecksum, pchHeader + CMessageHeader::CHECKSUM_OFFSET, CMessageHeader::CHECKSUM_SIZE);
+
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
             return -1;
 
+    GetRecvBufferPool().Take(vRecv, hdr.nMessageSize);
+
     // switch state to reading message data
     in_data = true;
 
@@ -843,27 +948,58 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->size() > pnode->nSendOffset);
+        size_t nToSend = 0;
+#ifndef WIN32
+        // Hand as many queued entries as possible to one system call, the
+        // header and the data of a message are separate entries
+        struct iovec iov[MAX_SEND_IOVECS];
+        int nIov = 0;
+        for (auto itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++itIov, ++nIov) {
+            size_t nOffset = nIov == 0 ? pnode->nSendOffset : 0;
+            iov[nIov].iov_base = const_cast<unsigned char*>(itIov->data()) + nOffset;
+            iov[nIov].iov_len = itIov->size() - nOffset;
+            nToSend += iov[nIov].iov_len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+#else
+        nToSend = it->size() - pnode->nSendOffset;
+#endif
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifndef WIN32
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(it->data()) + pnode->nSendOffset, nToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
+        pnode->nSendCalls++;
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // drop the entries that were sent completely
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                size_t nLeft = it->size() - pnode->nSendOffset;
+                if (nSent < nLeft) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nToSend) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1068,7 +1204,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (socketEvents->GetMode() == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1122,308 +1258,441 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    RegisterSocketEvents(pnode);
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        std::vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect)
             {
-                if (pnode->fDisconnect)
-                {
-                    LogPrintf("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fInbound=%d fMasternode=%d\n",
-                              pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fInbound, pnode->fMasternode);
+                LogPrintf("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fInbound=%d fMasternode=%d\n",
+                          pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fInbound, pnode->fMasternode);
+
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // stop serving its remembered socket readiness
+                if (pnode->fSocketReadyListed) {
+                    vNodesSocketReady.erase(remove(vNodesSocketReady.begin(), vNodesSocketReady.end(), pnode), vNodesSocketReady.end());
+                    pnode->fSocketReadyListed = false;
+                }
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
-                    pnode->grantMasternodeOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+                pnode->grantMasternodeOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
-            {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_inventory, lockInv);
-                        if (lockInv) {
-                            TRY_LOCK(pnode->cs_vSend, lockSend);
-                            if (lockSend) {
-                                fDelete = true;
-                            }
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                    if (lockInv) {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend) {
+                            fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged(unsigned int& nPrevNodeCount)
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if(clientInterface)
+            clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
         {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if(clientInterface)
-                clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrintf("version handshake timeout from %d\n", pnode->id);
+            pnode->fDisconnect = true;
+        }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+bool CConnman::SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    pnode->nRecvCalls++;
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler(pnode);
+        }
+        return true;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
 
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+const CConnman::ListenSocket* CConnman::FindListenSocket(const void* pData) const
+{
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        if (&hListenSocket == pData)
+            return &hListenSocket;
+    }
+    return NULL;
+}
 
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+void CConnman::RegisterSocketEvents(CNode* pnode)
+{
+    if (!socketEvents || socketEvents->GetMode() != SOCKETEVENTS_EPOLL)
+        return;
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket != INVALID_SOCKET && !socketEvents->Add(pnode->hSocket, pnode, true)) {
+        LogPrintf("cannot watch the socket of peer=%d, disconnecting\n", pnode->id);
+        pnode->fDisconnect = true;
+    }
+}
+
+void CConnman::SocketHandlerSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+        socketEvents->Watch(hListenSocket.socket, &hListenSocket, true, false);
+    }
 
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
             {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
 
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+            socketEvents->Watch(pnode->hSocket, pnode, select_recv && !select_send, select_send);
+        }
+    }
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+    std::vector<SocketEvent> vEvents;
+    if (!socketEvents->Wait(SOCKET_SELECT_TIMEOUT_MILLISECONDS, vEvents)) {
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_SELECT_TIMEOUT_MILLISECONDS)))
+            return;
+    }
+    if (interruptNet)
+        return;
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH(const SocketEvent& event, vEvents)
+    {
+        const ListenSocket* pListenSocket = FindListenSocket(event.pData);
+        if (pListenSocket) {
+            if (pListenSocket->socket != INVALID_SOCKET && event.fRecv)
+                AcceptConnection(*pListenSocket);
+        } else {
+            CNode* pnode = static_cast<CNode*>(event.pData);
+            pnode->fSocketRecvReady = event.fRecv || event.fError;
+            pnode->fSocketSendReady = event.fSend;
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    //
+    // Service each socket
+    //
+    std::vector<CNode*> vNodesCopy = CopyNodeVector();
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
+    {
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
+        bool recvSet = pnode->fSocketRecvReady;
+        bool sendSet = pnode->fSocketSendReady;
+        pnode->fSocketRecvReady = false;
+        pnode->fSocketSendReady = false;
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
         }
 
         //
-        // Accept new connections
+        // Receive
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
-        {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
-        }
+        if (recvSet)
+            SocketRecvData(pnode);
 
         //
-        // Service each socket
+        // Send
         //
-        std::vector<CNode*> vNodesCopy = CopyNodeVector();
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        if (sendSet)
         {
-            if (interruptNet)
-                return;
-
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet)
-            {
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = 0;
-                        {
-                            LOCK(pnode->cs_hSocket);
-                            if (pnode->hSocket == INVALID_SOCKET)
-                                continue;
-                            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        }
-                        if (nBytes > 0)
-                        {
-                            bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                                pnode->CloseSocketDisconnect();
-                            RecordBytesRecv(nBytes);
-                            if (notify) {
-                                size_t nSizeAdded = 0;
-                                auto it(pnode->vRecvMsg.begin());
-                                for (; it != pnode->vRecvMsg.end(); ++it) {
-                                    if (!it->complete())
-                                        break;
-                                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                                }
-                                {
-                                    LOCK(pnode->cs_vProcessMsg);
-                                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                                    pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                                }
-                                WakeMessageHandler();
-                            }
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes) {
+                RecordBytesSent(nBytes);
             }
+        }
 
-            //
-            // Send
-            //
-            if (sendSet)
-            {
-                LOCK(pnode->cs_vSend);
+        InactivityCheck(pnode);
+    }
+    ReleaseNodeVector(vNodesCopy);
+}
+
+void CConnman::SocketHandlerEpoll(int64_t nTimeoutMs)
+{
+    // Nodes that are still readable, and neither paused nor waiting for their
+    // send queue to drain, are served again without waiting.
+    BOOST_FOREACH(CNode* pnode, vNodesSocketReady)
+    {
+        if (!pnode->fSocketRecvReady || pnode->fPauseRecv)
+            continue;
+        LOCK(pnode->cs_vSend);
+        if (pnode->vSendMsg.empty()) {
+            nTimeoutMs = 0;
+            break;
+        }
+    }
+
+    std::vector<SocketEvent> vEvents;
+    if (!socketEvents->Wait(nTimeoutMs, vEvents)) {
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_SELECT_TIMEOUT_MILLISECONDS)))
+            return;
+    }
+    if (interruptNet)
+        return;
+
+    BOOST_FOREACH(const SocketEvent& event, vEvents)
+    {
+        const ListenSocket* pListenSocket = FindListenSocket(event.pData);
+        if (pListenSocket) {
+            if (pListenSocket->socket != INVALID_SOCKET && event.fRecv)
+                AcceptConnection(*pListenSocket);
+            continue;
+        }
+        // Sockets are registered edge triggered: remember the readiness until
+        // a recv() or send() would block.
+        CNode* pnode = static_cast<CNode*>(event.pData);
+        if (event.fRecv || event.fError)
+            pnode->fSocketRecvReady = true;
+        if (event.fSend)
+            pnode->fSocketSendReady = true;
+        if (!pnode->fSocketReadyListed) {
+            pnode->fSocketReadyListed = true;
+            vNodesSocketReady.push_back(pnode);
+        }
+    }
+
+    //
+    // Service each ready socket, once per wakeup like the select() loop does
+    //
+    std::vector<CNode*> vNodesReady;
+    vNodesReady.swap(vNodesSocketReady);
+    BOOST_FOREACH(CNode* pnode, vNodesReady)
+    {
+        pnode->fSocketReadyListed = false;
+        if (interruptNet || pnode->fDisconnect) {
+            pnode->fSocketRecvReady = false;
+            pnode->fSocketSendReady = false;
+            continue;
+        }
+
+        bool fSendPending;
+        {
+            LOCK(pnode->cs_vSend);
+            if (pnode->fSocketSendReady && !pnode->vSendMsg.empty()) {
                 size_t nBytes = SocketSendData(pnode);
                 if (nBytes) {
                     RecordBytesSent(nBytes);
                 }
+                // Anything left means the socket would block
+                if (!pnode->vSendMsg.empty())
+                    pnode->fSocketSendReady = false;
             }
+            fSendPending = !pnode->vSendMsg.empty();
+        }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrintf("version handshake timeout from %d\n", pnode->id);
-                    pnode->fDisconnect = true;
-                }
-            }
+        // Drain the send queue before receiving more, as the select() loop does
+        if (pnode->fSocketRecvReady && !pnode->fPauseRecv && !fSendPending) {
+            if (!SocketRecvData(pnode))
+                pnode->fSocketRecvReady = false;
+        }
+
+        if (pnode->fSocketRecvReady && !pnode->fDisconnect) {
+            pnode->fSocketReadyListed = true;
+            vNodesSocketReady.push_back(pnode);
         }
-        ReleaseNodeVector(vNodesCopy);
+    }
+}
+
+void CConnman::ThreadSocketHandler()
+{
+    unsigned int nPrevNodeCount = 0;
+    int64_t nLastHousekeeping = 0;
+    while (!interruptNet)
+    {
+        if (socketEvents->GetMode() != SOCKETEVENTS_EPOLL) {
+            DisconnectNodes();
+            NotifyNumConnectionsChanged(nPrevNodeCount);
+            SocketHandlerSelect();
+            continue;
+        }
+
+        // epoll only wakes up for sockets that changed state. Looking at all
+        // nodes for disconnects and timeouts is done at the pace the select()
+        // loop would have done it when idle, not on every wakeup.
+        int64_t nNow = GetTimeMillis();
+        if (nNow - nLastHousekeeping >= SOCKET_SELECT_TIMEOUT_MILLISECONDS) {
+            nLastHousekeeping = nNow;
+            DisconnectNodes();
+            NotifyNumConnectionsChanged(nPrevNodeCount);
+            std::vector<CNode*> vNodesCopy = CopyNodeVector();
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                InactivityCheck(pnode);
+            ReleaseNodeVector(vNodesCopy);
+        }
+        SocketHandlerEpoll(std::max<int64_t>(0, nLastHousekeeping + SOCKET_SELECT_TIMEOUT_MILLISECONDS - GetTimeMillis()));
     }
 }
 
 void CConnman::WakeMessageHandler()
 {
+    for (const auto& handler : vMessageHandlers) {
+        {
+            std::lock_guard<std::mutex> lock(handler->mutex);
+            handler->fWake = true;
+        }
+        handler->cond.notify_one();
+    }
+}
+
+void CConnman::WakeMessageHandler(const CNode* pnode)
+{
+    if (vMessageHandlers.empty())
+        return;
+    MessageHandler& handler = *vMessageHandlers[GetMessageHandlerIndex(pnode)];
     {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        std::lock_guard<std::mutex> lock(handler.mutex);
+        handler.fWake = true;
     }
-    condMsgProc.notify_one();
+    handler.cond.notify_one();
+}
+
+size_t CConnman::GetMessageHandlerIndex(const CNode* pnode) const
+{
+    return pnode->GetId() % vMessageHandlers.size();
 }
 
 
@@ -2031,6 +2300,7 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    RegisterSocketEvents(pnode);
 
     return true;
 }
@@ -2039,8 +2309,10 @@ bool CConnman::OpenMasternodeConnection(const CAddress &addrConnect) {
     return OpenNetworkConnection(addrConnect, false, NULL, NULL, false, false, false, true);
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(size_t nHandler)
 {
+    MessageHandler& handler = *vMessageHandlers[nHandler];
+
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy = CopyNodeVector();
@@ -2049,7 +2321,7 @@ void CConnman::ThreadMessageHandler()
 
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            if (pnode->fDisconnect)
+            if (pnode->fDisconnect || GetMessageHandlerIndex(pnode) != nHandler)
                 continue;
 
             // Receive messages
@@ -2069,11 +2341,11 @@ void CConnman::ThreadMessageHandler()
 
         ReleaseNodeVector(vNodesCopy);
 
-        std::unique_lock<std::mutex> lock(mutexMsgProc);
+        std::unique_lock<std::mutex> lock(handler.mutex);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            handler.cond.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [&handler] { return handler.fWake; });
         }
-        fMsgProcWake = false;
+        handler.fWake = false;
     }
 }
 
@@ -2270,6 +2542,7 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) :
     nMaxAddnode = 0;
     nBestHeight = 0;
     clientInterface = NULL;
+    nMsgHandThreads = DEFAULT_MSGHAND_THREADS;
     flagInterruptMsgProc = false;
 }
 
@@ -2298,6 +2571,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
+    nMsgHandThreads = std::max(1, std::min(connOptions.nMsgHandThreads, MAX_MSGHAND_THREADS));
+
     SetBestHeight(connOptions.nBestHeight);
 
     clientInterface = connOptions.uiInterface;
@@ -2359,9 +2634,18 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     interruptNet.reset();
     flagInterruptMsgProc = false;
 
-    {
-        std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+    // Set up before the socket handler, which wakes them as messages arrive
+    vMessageHandlers.clear();
+    for (int i = 0; i < nMsgHandThreads; i++)
+        vMessageHandlers.emplace_back(new MessageHandler());
+
+    socketEvents.reset(new CSocketEvents(connOptions.socketEventsMode));
+    LogPrintf("Using %s for network sockets\n", GetSocketEventsModeName(socketEvents->GetMode()));
+    BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+        if (!socketEvents->Add(hListenSocket.socket, &hListenSocket, false)) {
+            strNodeError = _("Failed to watch the listening sockets for incoming connections.");
+            return false;
+        }
     }
 
     // Send and receive from sockets, accept connections
@@ -2383,7 +2667,9 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     threadOpenMasternodeConnections = std::thread(&TraceThread<std::function<void()> >, "mncon", std::function<void()>(std::bind(&CConnman::ThreadOpenMasternodeConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    LogPrintf("Using %d threads for processing peer messages\n", nMsgHandThreads);
+    for (size_t i = 0; i < vMessageHandlers.size(); i++)
+        vMessageHandlers[i]->thread = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
@@ -2416,11 +2702,11 @@ void CExplicitNetCleanup::callCleanup()
 
 void CConnman::Interrupt()
 {
-    {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        flagInterruptMsgProc = true;
+    flagInterruptMsgProc = true;
+    for (const auto& handler : vMessageHandlers) {
+        std::lock_guard<std::mutex> lock(handler->mutex);
+        handler->cond.notify_all();
     }
-    condMsgProc.notify_all();
 
     interruptNet();
     InterruptSocks5(true);
@@ -2446,8 +2732,10 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (const auto& handler : vMessageHandlers) {
+        if (handler->thread.joinable())
+            handler->thread.join();
+    }
     if (threadOpenMasternodeConnections.joinable())
         threadOpenMasternodeConnections.join();
     if (threadOpenConnections.joinable())
@@ -2482,7 +2770,9 @@ void CConnman::Stop()
     }
     vNodes.clear();
     vNodesDisconnected.clear();
+    vNodesSocketReady.clear();
     vhListenSocket.clear();
+    socketEvents.reset();
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2787,6 +3077,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nLastRecv = 0;
     nSendBytes = 0;
     nRecvBytes = 0;
+    nSendCalls = 0;
+    nRecvCalls = 0;
     nTimeOffset = 0;
     addrName = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
     nVersion = 0;
@@ -2825,6 +3117,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
     fPauseRecv = false;
     fPauseSend = false;
+    fSocketRecvReady = false;
+    fSocketSendReady = false;
+    fSocketReadyListed = false;
     nProcessQueueSize = 0;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
@@ -2898,13 +3193,14 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    const std::vector<unsigned char>& vData = msg.GetData();
+    size_t nMessageSize = vData.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
+    uint256 hash = Hash(vData.data(), vData.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
@@ -2921,9 +3217,13 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.emplace_back(std::move(serializedHeader));
+        if (nMessageSize) {
+            if (msg.shared_data)
+                pnode->vSendMsg.emplace_back(msg.shared_data);
+            else
+                pnode->vSendMsg.emplace_back(std::move(msg.data));
+        }
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
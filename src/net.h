@@ -15,6 +15,7 @@
 #include "netaddress.h"
 #include "protocol.h"
 #include "random.h"
+#include "socketevents.h"
 #include "streams.h"
 #include "sync.h"
 #include "uint256.h"
@@ -68,6 +69,12 @@ static const int MAX_ADDNODE_CONNECTIONS = 8;
 static const int MAX_OUTBOUND_MASTERNODE_CONNECTIONS = 20;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
+/** -msghandthreads default, the number of threads processing peer messages */
+static const int DEFAULT_MSGHAND_THREADS = 1;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MSGHAND_THREADS = 16;
+/** Longest wait of the socket handler for socket events, after which it looks at all peers again (in milliseconds) */
+static const int64_t SOCKET_SELECT_TIMEOUT_MILLISECONDS = 50;
 /** -upnp default */
 #ifdef USE_UPNP
 static const bool DEFAULT_UPNP = USE_UPNP;
@@ -121,6 +128,25 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string command;
+    // Data that other messages hold too, sent instead of data when set
+    std::shared_ptr<const std::vector<unsigned char> > shared_data;
+
+    const std::vector<unsigned char>& GetData() const { return shared_data ? *shared_data : data; }
+};
+
+/** Bytes queued for sending, of one message or shared with other messages */
+class CSendBuffer
+{
+public:
+    CSendBuffer(std::vector<unsigned char>&& vchIn) : vch(std::move(vchIn)) {}
+    CSendBuffer(const std::shared_ptr<const std::vector<unsigned char> >& pvchIn) : pvch(pvchIn) {}
+
+    const unsigned char* data() const { return pvch ? pvch->data() : vch.data(); }
+    size_t size() const { return pvch ? pvch->size() : vch.size(); }
+
+private:
+    std::vector<unsigned char> vch;
+    std::shared_ptr<const std::vector<unsigned char> > pvch;
 };
 
 
@@ -149,6 +175,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        SocketEventsMode socketEventsMode = DEFAULT_SOCKETEVENTS_MODE;
+        int nMsgHandThreads = DEFAULT_MSGHAND_THREADS;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -393,8 +421,13 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake all message processing threads */
     void WakeMessageHandler();
+    /** Wake the message processing thread that handles pnode */
+    void WakeMessageHandler(const CNode* pnode);
 private:
+    friend struct CConnmanTest;
+
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
@@ -405,8 +438,18 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(size_t nHandler);
+    size_t GetMessageHandlerIndex(const CNode* pnode) const;
     void AcceptConnection(const ListenSocket& hListenSocket);
+    const ListenSocket* FindListenSocket(const void* pData) const;
+    void RegisterSocketEvents(CNode* pnode);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged(unsigned int& nPrevNodeCount);
+    void InactivityCheck(CNode* pnode);
+    /** Receive once from a peer's socket, returns false if nothing more can be read right now */
+    bool SocketRecvData(CNode* pnode);
+    void SocketHandlerSelect();
+    void SocketHandlerEpoll(int64_t nTimeoutMs);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
     void ThreadOpenMasternodeConnections();
@@ -480,6 +523,10 @@ private:
     std::vector<CNode*> vNodes;
     std::list<CNode*> vNodesDisconnected;
     mutable CCriticalSection cs_vNodes;
+    //! Readiness notification for the sockets, used by the socket handler thread only
+    std::unique_ptr<CSocketEvents> socketEvents;
+    //! Nodes with socket readiness left to serve (epoll only, socket handler thread only)
+    std::vector<CNode*> vNodesSocketReady;
     std::atomic<NodeId> nLastNodeId;
 
     /** Services this instance offers */
@@ -501,11 +548,24 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * A message processing thread. Peers are spread over the threads by their
+     * id, so the messages of a peer are always processed by the same thread,
+     * in the order they were received.
+     */
+    struct MessageHandler
+    {
+        /** flag for waking the message processor. */
+        bool fWake;
+
+        std::condition_variable cond;
+        std::mutex mutex;
+        std::thread thread;
 
-    std::condition_variable condMsgProc;
-    std::mutex mutexMsgProc;
+        MessageHandler() : fWake(false) {}
+    };
+    int nMsgHandThreads;
+    std::vector<std::unique_ptr<MessageHandler> > vMessageHandlers;
     std::atomic<bool> flagInterruptMsgProc;
 
     CThreadInterrupt interruptNet;
@@ -515,7 +575,6 @@ private:
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadOpenMasternodeConnections;
-    std::thread threadMessageHandler;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -613,8 +672,10 @@ public:
     bool fAddnode;
     int nStartingHeight;
     uint64_t nSendBytes;
+    uint64_t nSendCalls;
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
+    uint64_t nRecvCalls;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
     bool fWhitelisted;
     double dPingTime;
@@ -634,7 +695,7 @@ private:
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
@@ -643,13 +704,15 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -662,7 +725,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -683,7 +745,8 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    uint64_t nSendCalls; // send system calls made, including ones that would have blocked
+    std::deque<CSendBuffer> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -696,6 +759,7 @@ public:
 
     std::deque<CInv> vRecvGetData;
     uint64_t nRecvBytes;
+    std::atomic<uint64_t> nRecvCalls; // recv system calls made, including ones that would have blocked; counted outside cs_vRecv
     std::atomic<int> nRecvVersion;
 
     std::atomic<int64_t> nLastSend;
@@ -739,6 +803,11 @@ public:
 
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+
+    // Socket readiness as seen by the socket handler thread, only used by it
+    bool fSocketRecvReady;
+    bool fSocketSendReady;
+    bool fSocketReadyListed;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
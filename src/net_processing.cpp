@@ -202,6 +202,10 @@ struct CNodeState {
      * otherwise: whether this peer sends non-last version in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Number of tx messages at the front of the receive queue whose scripts were already verified in a batch.
+    unsigned int nTxPreverified;
+    //! Whether a script check failed in a batch of this peer; its later transactions are not pre-verified.
+    bool fTxPreverifyFailed;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -223,6 +227,8 @@ struct CNodeState {
         fPreferHeaderAndIDs = false;
         fProvidesHeaderAndIDs = false;
         fSupportsDesiredCmpctVersion = false;
+        nTxPreverified = 0;
+        fTxPreverifyFailed = false;
     }
 };
 
@@ -929,22 +935,25 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         return instantsend.AlreadyHave(inv.hash);
 
     case MSG_SPORK:
-        return mapSporks.count(inv.hash);
+        {
+            CSporkMessage spork;
+            return sporkManager.GetSporkByHash(inv.hash, spork);
+        }
 
     case MSG_MASTERNODE_PAYMENT_VOTE:
-        return mnpayments.mapMasternodePaymentVotes.count(inv.hash);
+        return mnpayments.HasPaymentVote(inv.hash);
 
     case MSG_MASTERNODE_PAYMENT_BLOCK:
         {
             BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-            return mi != mapBlockIndex.end() && mnpayments.mapMasternodeBlocks.find(mi->second->nHeight) != mnpayments.mapMasternodeBlocks.end();
+            return mi != mapBlockIndex.end() && mnpayments.HasPayeesForHeight(mi->second->nHeight);
         }
 
     case MSG_MASTERNODE_ANNOUNCE:
-        return mnodeman.mapSeenMasternodeBroadcast.count(inv.hash) && !mnodeman.IsMnbRecoveryRequested(inv.hash);
+        return mnodeman.HasSeenMasternodeBroadcast(inv.hash) && !mnodeman.IsMnbRecoveryRequested(inv.hash);
 
     case MSG_MASTERNODE_PING:
-        return mnodeman.mapSeenMasternodePing.count(inv.hash);
+        return mnodeman.HasSeenMasternodePing(inv.hash);
 
     case MSG_DSTX: {
         return static_cast<bool>(CPrivateSend::GetDSTX(inv.hash));
@@ -955,7 +964,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         return ! governance.ConfirmInventoryRequest(inv);
 
     case MSG_MASTERNODE_VERIFY:
-        return mnodeman.mapSeenMasternodeVerification.count(inv.hash);
+        return mnodeman.HasSeenMasternodeVerification(inv.hash);
     }
 
     // Don't know what it is, just say we already got one
@@ -998,6 +1007,77 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+namespace {
+/**
+ * Serialized blocks recently sent to peers, least recently sent ones are
+ * dropped first. Peers syncing from us tend to ask for the same blocks at
+ * about the same time, and a new block is asked for by many peers at once.
+ */
+class CRawBlockCache
+{
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char> > RawBlockRef;
+
+    /** Total size of the blocks kept */
+    static const size_t MAX_CACHE_SIZE = 16 * 1024 * 1024;
+
+    CRawBlockCache() : nSize(0) {}
+
+    RawBlockRef Get(const uint256& hash)
+    {
+        auto it = mapBlocks.find(hash);
+        if (it == mapBlocks.end())
+            return nullptr;
+        listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+        return it->second->second;
+    }
+
+    void Add(const uint256& hash, const RawBlockRef& block)
+    {
+        if (mapBlocks.count(hash) || block->size() > MAX_CACHE_SIZE)
+            return;
+        listBlocks.emplace_front(hash, block);
+        mapBlocks.emplace(hash, listBlocks.begin());
+        nSize += block->size();
+        while (nSize > MAX_CACHE_SIZE) {
+            nSize -= listBlocks.back().second->size();
+            mapBlocks.erase(listBlocks.back().first);
+            listBlocks.pop_back();
+        }
+    }
+
+private:
+    typedef std::list<std::pair<uint256, RawBlockRef> > BlockList;
+
+    size_t nSize;
+    BlockList listBlocks;
+    std::map<uint256, BlockList::iterator> mapBlocks;
+};
+
+/** Protected by cs_main */
+CRawBlockCache recentRawBlocks;
+} // anon namespace
+
+/**
+ * A block message with the block as stored, it is not deserialized and
+ * serialized again. The message shares the cached block with the send queue.
+ */
+static bool MakeRawBlockMessage(CSerializedNetMsg& msg, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    CRawBlockCache::RawBlockRef block = recentRawBlocks.Get(pindex->GetBlockHash());
+    if (!block) {
+        std::shared_ptr<std::vector<unsigned char> > blockRead = std::make_shared<std::vector<unsigned char> >();
+        if (!ReadRawBlockFromDisk(*blockRead, pindex))
+            return false;
+        block = blockRead;
+        recentRawBlocks.Add(pindex->GetBlockHash(), block);
+    }
+    msg.command = NetMsgType::BLOCK;
+    msg.shared_data = block;
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -1068,12 +1148,25 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                    // If a peer is asking for old blocks, we're almost guaranteed
+                    // they won't have a useful mempool to match against a compact block,
+                    // and we don't feel like constructing the object for them, so
+                    // instead we respond with the full, non-compact block.
+                    bool fSendCompact = inv.type == MSG_CMPCT_BLOCK && CanDirectFetch(consensusParams) &&
+                        mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    // Full blocks are sent as stored, only filtered and compact blocks need the CBlock
+                    bool fSendRaw = inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCompact);
+
                     // Send block from disk
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (!fSendRaw && !ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                    if (fSendRaw) {
+                        CSerializedNetMsg msg;
+                        if (!MakeRawBlockMessage(msg, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        connman.PushMessage(pfrom, std::move(msg));
+                    }
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool sendMerkleBlock = false;
@@ -1100,17 +1193,10 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         // else
                             // no response
                     }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    else if (fSendCompact)
                     {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they won't have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                         if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block);
-                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, cmpctblock));
-                        } else
-                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                        CBlockHeaderAndShortTxIDs cmpctblock(block);
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
@@ -1165,29 +1251,29 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 }
 
                 if (!push && inv.type == MSG_SPORK) {
-                    if(mapSporks.count(inv.hash)) {
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SPORK, mapSporks[inv.hash]));
+                    CSporkMessage spork;
+                    if(sporkManager.GetSporkByHash(inv.hash, spork)) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SPORK, spork));
                         push = true;
                     }
                 }
 
                 if (!push && inv.type == MSG_MASTERNODE_PAYMENT_VOTE) {
-                    if(mnpayments.HasVerifiedPaymentVote(inv.hash)) {
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MASTERNODEPAYMENTVOTE, mnpayments.mapMasternodePaymentVotes[inv.hash]));
+                    CMasternodePaymentVote vote;
+                    if(mnpayments.GetPaymentVote(inv.hash, vote) && vote.IsVerified()) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MASTERNODEPAYMENTVOTE, vote));
                         push = true;
                     }
                 }
 
                 if (!push && inv.type == MSG_MASTERNODE_PAYMENT_BLOCK) {
                     BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                    LOCK(cs_mapMasternodeBlocks);
-                    if (mi != mapBlockIndex.end() && mnpayments.mapMasternodeBlocks.count(mi->second->nHeight)) {
-                        BOOST_FOREACH(CMasternodePayee& payee, mnpayments.mapMasternodeBlocks[mi->second->nHeight].vecPayees) {
-                            std::vector<uint256> vecVoteHashes = payee.GetVoteHashes();
-                            BOOST_FOREACH(uint256& hash, vecVoteHashes) {
-                                if(mnpayments.HasVerifiedPaymentVote(hash)) {
-                                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MASTERNODEPAYMENTVOTE, mnpayments.mapMasternodePaymentVotes[hash]));
-                                }
+                    std::vector<uint256> vecVoteHashes;
+                    if (mi != mapBlockIndex.end() && mnpayments.GetBlockVoteHashes(mi->second->nHeight, vecVoteHashes)) {
+                        for (const auto& hash : vecVoteHashes) {
+                            CMasternodePaymentVote vote;
+                            if(mnpayments.GetPaymentVote(hash, vote) && vote.IsVerified()) {
+                                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MASTERNODEPAYMENTVOTE, vote));
                             }
                         }
                         push = true;
@@ -1195,15 +1281,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 }
 
                 if (!push && inv.type == MSG_MASTERNODE_ANNOUNCE) {
-                    if(mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)){
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNANNOUNCE, mnodeman.mapSeenMasternodeBroadcast[inv.hash].second));
+                    CMasternodeBroadcast mnb;
+                    if(mnodeman.GetSeenMasternodeBroadcast(inv.hash, mnb)) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNANNOUNCE, mnb));
                         push = true;
                     }
                 }
 
                 if (!push && inv.type == MSG_MASTERNODE_PING) {
-                    if(mnodeman.mapSeenMasternodePing.count(inv.hash)) {
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNPING, mnodeman.mapSeenMasternodePing[inv.hash]));
+                    CMasternodePing mnp;
+                    if(mnodeman.GetSeenMasternodePing(inv.hash, mnp)) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNPING, mnp));
                         push = true;
                     }
                 }
@@ -1254,8 +1342,9 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 }
 
                 if (!push && inv.type == MSG_MASTERNODE_VERIFY) {
-                    if(mnodeman.mapSeenMasternodeVerification.count(inv.hash)) {
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNVERIFY, mnodeman.mapSeenMasternodeVerification[inv.hash]));
+                    CMasternodeVerification mnv;
+                    if(mnodeman.GetSeenMasternodeVerification(inv.hash, mnv)) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNVERIFY, mnv));
                         push = true;
                     }
                 }
@@ -1302,6 +1391,68 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Verify the scripts of a transaction together with the tx messages queued
+ * right behind it by the same peer, so that a burst of transactions is checked
+ * in parallel while each one is still accepted in order. The queued messages
+ * covered by a batch are counted so they do not start batches of their own.
+ * Transactions we already have or rejected recently are left out. Once a
+ * script check of a peer's batch fails, the peer's transactions are only
+ * verified by AcceptToMemoryPool, which punishes it for invalid ones.
+ */
+void static PreverifyQueuedTransactions(CNode* pfrom, const CTransactionRef& ptx)
+{
+    std::vector<CTransactionRef> vtx;
+    {
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        if (nodestate->nTxPreverified > 0) {
+            nodestate->nTxPreverified--;
+            return;
+        }
+        if (!nScriptCheckThreads || nodestate->fTxPreverifyFailed)
+            return;
+
+        std::vector<CTransactionRef> vtxQueued(1, ptx);
+        {
+            LOCK(pfrom->cs_vProcessMsg);
+            for (const CNetMessage& msg : pfrom->vProcessMsg) {
+                if (vtxQueued.size() >= MAX_TX_PREVERIFY_BATCH || msg.hdr.GetCommand() != NetMsgType::TX)
+                    break;
+                try {
+                    CDataStream vRecvQueued(msg.vRecv);
+                    CTransactionRef ptxQueued;
+                    vRecvQueued >> ptxQueued;
+                    vtxQueued.push_back(ptxQueued);
+                } catch (const std::exception&) {
+                    break;
+                }
+            }
+        }
+        if (vtxQueued.size() == 1)
+            return;
+        nodestate->nTxPreverified = vtxQueued.size() - 1;
+
+        for (const CTransactionRef& ptxQueued : vtxQueued) {
+            if (!AlreadyHave(CInv(MSG_TX, ptxQueued->GetHash())))
+                vtx.push_back(ptxQueued);
+        }
+    }
+    if (vtx.size() <= 1)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    bool fScriptFailed = false;
+    unsigned int nChecks = PreverifyTransactionBatch(mempool, vtx, &fScriptFailed);
+    LogPrint("bench", "Preverified %u txs from peer=%d: %u inputs, %.2fms\n", vtx.size(), pfrom->id, nChecks, (GetTimeMicros() - nTimeStart) * 0.001);
+    if (fScriptFailed) {
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        if (nodestate)
+            nodestate->fTxPreverifyFailed = true;
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1983,6 +2134,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             mnodeman.DisallowMixing(dstx.masternodeOutpoint);
         }
 
+        if (strCommand == NetMsgType::TX)
+            PreverifyQueuedTransactions(pfrom, ptx);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
@@ -2853,6 +3007,39 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     return true;
 }
 
+/**
+ * Bastoji messages that ProcessMessage() hands to their subsystems, which
+ * handle them under their own locks (CMasternodeMan::cs, CGovernanceManager::cs,
+ * cs_instantsend, cs_darksend, CSporkManager::cs, ...) and only take cs_main
+ * where they need the chain. Several handler threads may run them at once.
+ */
+static bool IsSubsystemMessage(const std::string& strCommand)
+{
+    static const std::set<std::string> setSubsystemMessages = {
+        NetMsgType::TXLOCKVOTE,
+        NetMsgType::SPORK,
+        NetMsgType::GETSPORKS,
+        NetMsgType::MASTERNODEPAYMENTVOTE,
+        NetMsgType::MASTERNODEPAYMENTSYNC,
+        NetMsgType::MNANNOUNCE,
+        NetMsgType::MNPING,
+        NetMsgType::DSACCEPT,
+        NetMsgType::DSVIN,
+        NetMsgType::DSFINALTX,
+        NetMsgType::DSSIGNFINALTX,
+        NetMsgType::DSCOMPLETE,
+        NetMsgType::DSSTATUSUPDATE,
+        NetMsgType::DSQUEUE,
+        NetMsgType::DSEG,
+        NetMsgType::SYNCSTATUSCOUNT,
+        NetMsgType::MNGOVERNANCESYNC,
+        NetMsgType::MNGOVERNANCEOBJECT,
+        NetMsgType::MNGOVERNANCEOBJECTVOTE,
+        NetMsgType::MNVERIFY,
+    };
+    return setSubsystemMessages.count(strCommand) != 0;
+}
+
 static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman& connman)
 {
     AssertLockHeld(cs_main);
@@ -2997,8 +3184,16 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
         }
 
-        LOCK(cs_main);
-        SendRejectsAndCheckIfBanned(pfrom, connman);
+        if (IsSubsystemMessage(strCommand)) {
+            // Don't make these wait for cs_main just for rejects and bans, which
+            // SendMessages() also delivers when it has cs_main.
+            TRY_LOCK(cs_main, lockMain);
+            if (lockMain)
+                SendRejectsAndCheckIfBanned(pfrom, connman);
+        } else {
+            LOCK(cs_main);
+            SendRejectsAndCheckIfBanned(pfrom, connman);
+        }
 
     return fMoreWork;
 }
@@ -12,11 +12,40 @@
 
 uint256 CBlockHeader::GetHash() const
 {
-	 uint256 thash;
+    static_assert(sizeof(vchHashedHeader) == 80, "Lyra2REv2 hashes the 80 byte header");
 
-	 lyra2re2_hash(BEGIN(nVersion), BEGIN(thash));
+    uint256 thash;
+    if (GetCachedHash(thash))
+        return thash;
 
-	 return thash;
+    lyra2re2_hash(BEGIN(nVersion), BEGIN(thash));
+    SetCachedHash(thash);
+
+    return thash;
+}
+
+void CBlockHeader::SetCachedHash(const uint256& hash) const
+{
+    uint256 hashCached;
+    if (GetCachedHash(hashCached))
+        return;
+    // Only one thread writes the cache; if another one is at it, leave it be
+    int nState = nHashCacheState.load(std::memory_order_relaxed);
+    if (nState == HASH_CACHE_FILLING || !nHashCacheState.compare_exchange_strong(nState, HASH_CACHE_FILLING, std::memory_order_acquire))
+        return;
+    memcpy(vchHashedHeader, BEGIN(nVersion), sizeof(vchHashedHeader));
+    cachedHash = hash;
+    nHashCacheState.store(HASH_CACHE_VALID, std::memory_order_release);
+}
+
+bool CBlockHeader::GetCachedHash(uint256& hash) const
+{
+    if (nHashCacheState.load(std::memory_order_acquire) != HASH_CACHE_VALID)
+        return false;
+    if (memcmp(vchHashedHeader, BEGIN(nVersion), sizeof(vchHashedHeader)) != 0)
+        return false;
+    hash = cachedHash;
+    return true;
 }
 
 std::string CBlock::ToString() const
@@ -11,6 +11,8 @@
 #include "uint256.h"
 #include "crypto/Lyra2RE/Lyra2RE.h"
 
+#include <atomic>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -29,11 +31,43 @@ public:
     uint32_t nBits;
     uint32_t nNonce;
 
-    CBlockHeader()
+    // memory only: GetHash() result and the 80 header bytes it was computed
+    // from; the cache is only used while those bytes still match the fields,
+    // so assigning to any header field invalidates it. Blocks are shared
+    // between threads, so the cache is published through nHashCacheState:
+    // one thread at a time fills it (HASH_CACHE_FILLING) and the others only
+    // read it once HASH_CACHE_VALID is visible to them.
+    enum { HASH_CACHE_EMPTY, HASH_CACHE_FILLING, HASH_CACHE_VALID };
+    mutable unsigned char vchHashedHeader[80];
+    mutable uint256 cachedHash;
+    mutable std::atomic<int> nHashCacheState;
+
+    CBlockHeader() : nHashCacheState(HASH_CACHE_EMPTY)
     {
         SetNull();
     }
 
+    CBlockHeader(const CBlockHeader& other) : nHashCacheState(HASH_CACHE_EMPTY)
+    {
+        *this = other;
+    }
+
+    CBlockHeader& operator=(const CBlockHeader& other)
+    {
+        nVersion       = other.nVersion;
+        hashPrevBlock  = other.hashPrevBlock;
+        hashMerkleRoot = other.hashMerkleRoot;
+        nTime          = other.nTime;
+        nBits          = other.nBits;
+        nNonce         = other.nNonce;
+        uint256 hash;
+        if (other.GetCachedHash(hash))
+            SetCachedHash(hash);
+        else
+            nHashCacheState = HASH_CACHE_EMPTY;
+        return *this;
+    }
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -54,6 +88,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        nHashCacheState = HASH_CACHE_EMPTY;
     }
 
     bool IsNull() const
@@ -63,6 +98,13 @@ public:
 
     uint256 GetHash() const;
 
+    /** Seed the hash cache with a hash known to belong to the current header
+     *  fields, e.g. from the block index entry they were compared against. */
+    void SetCachedHash(const uint256& hash) const;
+
+    /** The cached hash, if there is one for the current header fields */
+    bool GetCachedHash(uint256& hash) const;
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -80,6 +122,7 @@ public:
     mutable CTxOut txoutMasternode; // masternode payment
     mutable std::vector<CTxOut> voutSuperblock; // superblock payment
     mutable bool fChecked;
+    mutable bool fMerkleRootChecked; // hashMerkleRoot already verified against vtx
 
     CBlock()
     {
@@ -107,18 +150,12 @@ public:
         txoutMasternode = CTxOut();
         voutSuperblock.clear();
         fChecked = false;
+        fMerkleRootChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        return block;
+        return CBlockHeader(*this);
     }
 
     std::string ToString() const;
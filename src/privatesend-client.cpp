@@ -103,6 +103,8 @@ void CPrivateSendClient::ProcessMessage(CNode* pfrom, const std::string& strComm
 
     } else if(strCommand == NetMsgType::DSSTATUSUPDATE) {
 
+        LOCK(cs_darksend);
+
         if(pfrom->nVersion < MIN_PRIVATESEND_PEER_PROTO_VERSION) {
             LogPrint("privatesend", "DSSTATUSUPDATE -- peer=%d using obsolete version %i\n", pfrom->id, pfrom->nVersion);
             connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::REJECT, strCommand, REJECT_OBSOLETE,
@@ -147,6 +149,8 @@ void CPrivateSendClient::ProcessMessage(CNode* pfrom, const std::string& strComm
 
     } else if(strCommand == NetMsgType::DSFINALTX) {
 
+        LOCK(cs_darksend);
+
         if(pfrom->nVersion < MIN_PRIVATESEND_PEER_PROTO_VERSION) {
             LogPrint("privatesend", "DSFINALTX -- peer=%d using obsolete version %i\n", pfrom->id, pfrom->nVersion);
             connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::REJECT, strCommand, REJECT_OBSOLETE,
@@ -176,6 +180,8 @@ void CPrivateSendClient::ProcessMessage(CNode* pfrom, const std::string& strComm
 
     } else if(strCommand == NetMsgType::DSCOMPLETE) {
 
+        LOCK(cs_darksend);
+
         if(pfrom->nVersion < MIN_PRIVATESEND_PEER_PROTO_VERSION) {
             LogPrint("privatesend", "DSCOMPLETE -- peer=%d using obsolete version %i\n", pfrom->id, pfrom->nVersion);
             connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::REJECT, strCommand, REJECT_OBSOLETE,
@@ -10,6 +10,7 @@
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "indexdb.h"
 #include "instantx.h"
 #include "validation.h"
 #include "policy/policy.h"
@@ -630,6 +631,9 @@ UniValue getblockhashes(const JSONRPCRequest& request)
     unsigned int low = request.params[1].get_int();
     std::vector<uint256> blockHashes;
 
+    if (!WaitForIndexSync())
+        throw JSONRPCError(RPC_IN_WARMUP, "Indexes are still catching up with the active chain");
+
     if (!GetTimestampIndex(high, low, blockHashes)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for block hashes");
     }
@@ -1042,6 +1046,60 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+static UniValue DBStatsToJSON(const CDBWrapper& db)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("options", db.GetDBOptions().ToString()));
+
+    std::string strValue;
+    UniValue files(UniValue::VARR);
+    for (int nLevel = 0; db.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        files.push_back(atoi(strValue));
+    ret.push_back(Pair("files_per_level", files));
+    if (db.GetProperty("leveldb.approximate-memory-usage", strValue))
+        ret.push_back(Pair("memory_usage", atoi64(strValue)));
+    if (db.GetProperty("leveldb.stats", strValue))
+        ret.push_back(Pair("stats", strValue));
+    return ret;
+}
+
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getdbstats\n"
+            "\nReturns LevelDB statistics of the chainstate, block index and index databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {              (object) The UTXO database (chainstate/)\n"
+            "    \"options\": \"str\",          (string) The tuning in effect, see -chainstatedbopts\n"
+            "    \"files_per_level\": [n,...], (array) The number of table files at each level\n"
+            "    \"memory_usage\": n,          (numeric) Approximate memory used by LevelDB in bytes\n"
+            "    \"stats\": \"str\"             (string) LevelDB's compaction statistics\n"
+            "  },\n"
+            "  \"index\": {                   (object) The block index database (blocks/index/), same fields, see -indexdbopts\n"
+            "    ...\n"
+            "  },\n"
+            "  \"indexes\": {                 (object) The -addressindex, -spentindex and -timestampindex database (indexes/),\n"
+            "    ...                          same fields, see -indexdbopts. Only present when one of them is enabled\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview)
+        ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    if (pblocktree)
+        ret.push_back(Pair("index", DBStatsToJSON(*pblocktree)));
+    if (pindexdb)
+        ret.push_back(Pair("indexes", DBStatsToJSON(*pindexdb)));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1600,6 +1658,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
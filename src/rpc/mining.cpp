@@ -234,6 +234,8 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"errors\": \"...\"            (string) Current errors\n"
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
+            "  \"templateage\": n           (numeric) Seconds since the getblocktemplate template was built, -1 if there is none\n"
+            "  \"templatebuildtime\": n     (numeric) Milliseconds it took to build that template, -1 if there is none\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "}\n"
             "\nExamples:\n"
@@ -244,6 +246,9 @@ UniValue getmininginfo(const JSONRPCRequest& request)
 
     LOCK(cs_main);
 
+    int64_t nTemplateAge, nTemplateBuildTime;
+    blockTemplateBuilder.GetStats(nTemplateAge, nTemplateBuildTime);
+
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("blocks",           (int)chainActive.Height()));
     obj.push_back(Pair("currentblocksize", (uint64_t)nLastBlockSize));
@@ -252,6 +257,8 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("errors",           GetWarnings("statusbar")));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
+    obj.push_back(Pair("templateage",      nTemplateAge));
+    obj.push_back(Pair("templatebuildtime", nTemplateBuildTime < 0 ? -1 : nTemplateBuildTime * 0.001));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
     return obj;
 }
@@ -551,30 +558,14 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     }
 
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = nullptr;
-
-        // Store the chainActive.Tip() used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    const CBlockIndex* pindexPrev;
+    std::shared_ptr<const CBlockTemplate> pblocktemplateShared = blockTemplateBuilder.Get(Params(), pindexPrev, nTransactionsUpdatedLast);
+    if (!pblocktemplateShared)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+
+    // The template is shared with other requests, fill in time and version on a copy
+    CBlockTemplate blocktemplate(*pblocktemplateShared);
+    CBlock* pblock = &blocktemplate.block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
     // Update nTime
@@ -609,8 +600,8 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         entry.push_back(Pair("depends", deps));
 
         int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
+        entry.push_back(Pair("fee", blocktemplate.vTxFees[index_in_template]));
+        entry.push_back(Pair("sigops", blocktemplate.vTxSigOps[index_in_template]));
 
         transactions.push_back(entry);
     }
@@ -6,11 +6,13 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "indexdb.h"
 #include "init.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -654,6 +656,79 @@ bool getAddressesFromParams(const UniValue& params, std::vector<std::pair<uint16
     return true;
 }
 
+/**
+ * Read the optional "limit" and "cursor" fields of an address index request.
+ * Returns whether the request asks for a page of results. The cursor is the
+ * hex encoded index key of the first entry of the page; the address it
+ * belongs to is returned in first.
+ */
+template <typename K>
+bool getPageFromParams(const UniValue& params, const std::vector<std::pair<uint160, int> > &addresses,
+                       size_t &limit, K &cursor, std::vector<std::pair<uint160, int> >::const_iterator &first)
+{
+    first = addresses.begin();
+    if (!params[0].isObject())
+        return false;
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (limitValue.isNull()) {
+        if (!cursorValue.isNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor is only valid together with limit");
+        return false;
+    }
+    if (limitValue.get_int() <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit must be positive");
+    limit = limitValue.get_int();
+
+    if (!cursorValue.isNull()) {
+        std::string strCursor = cursorValue.get_str();
+        if (!IsHex(strCursor))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        CDataStream ssCursor(ParseHex(strCursor), SER_DISK, CLIENT_VERSION);
+        try {
+            ssCursor >> cursor;
+        } catch (const std::exception&) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+        if (!ssCursor.empty())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        while (first != addresses.end() && (first->first != cursor.hashBytes || (unsigned int)first->second != cursor.type))
+            first++;
+        if (first == addresses.end())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the requested addresses");
+    } else {
+        cursor.SetNull();
+    }
+    return true;
+}
+
+/** Wrap a page of results together with the cursor of the next page, if there is one. */
+template <typename K>
+UniValue pageResult(const std::string& name, const UniValue& results, const K* pnext)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair(name, results));
+    if (pnext) {
+        CDataStream ssCursor(SER_DISK, CLIENT_VERSION);
+        ssCursor << *pnext;
+        result.push_back(Pair("cursor", HexStr(ssCursor.begin(), ssCursor.end())));
+    }
+    return result;
+}
+
+/** Position an address index cursor at the page cursor, or else at the start height. */
+void seekAddressIndexCursor(CAddressIndexCursor& cursor, const std::pair<uint160, int>& address,
+                            const CAddressIndexKey* pstart, int start, int end)
+{
+    if (pstart && !pstart->hashBytes.IsNull())
+        cursor.Seek(*pstart);
+    else if (start > 0 && end > 0)
+        cursor.Seek(CAddressIndexIteratorHeightKey(address.second, address.first, start));
+    else
+        cursor.Seek(CAddressIndexIteratorKey(address.second, address.first));
+}
+
 bool heightSort(std::pair<CAddressUnspentKey, CAddressUnspentValue> a,
                 std::pair<CAddressUnspentKey, CAddressUnspentValue> b) {
     return a.second.blockHeight < b.second.blockHeight;
@@ -748,6 +823,8 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"limit\" (number, optional) Return at most this many outputs, in index order\n"
+            "  \"cursor\" (string, optional) Continue with the page that this cursor of a previous call points to\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -760,8 +837,14 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
             "    \"height\"  (number) The block height\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit):\n"
+            "{\n"
+            "  \"utxos\"  (array) The outputs as above, address by address in index order\n"
+            "  \"cursor\"  (string) Pass as cursor to get the next page; not present on the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -771,6 +854,47 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    if (!WaitForIndexSync())
+        throw JSONRPCError(RPC_IN_WARMUP, "Indexes are still catching up with the active chain");
+
+    size_t limit = 0;
+    CAddressUnspentKey cursor;
+    std::vector<std::pair<uint160, int> >::const_iterator first;
+    if (getPageFromParams(request.params, addresses, limit, cursor, first)) {
+        UniValue utxos(UniValue::VARR);
+        for (std::vector<std::pair<uint160, int> >::const_iterator it = first; it != addresses.end(); it++) {
+            std::unique_ptr<CAddressUnspentCursor> pcursor(GetAddressUnspentCursor((*it).first, (*it).second));
+            if (!pcursor) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+            if (it == first && !cursor.hashBytes.IsNull())
+                pcursor->Seek(cursor);
+            else
+                pcursor->Seek(CAddressIndexIteratorKey((*it).second, (*it).first));
+
+            std::string address;
+            if (!getAddressFromIndex((*it).second, (*it).first, address)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+            }
+            for (; pcursor->Valid(); pcursor->Next()) {
+                if (utxos.size() == limit)
+                    return pageResult("utxos", utxos, &pcursor->GetKey());
+
+                const CAddressUnspentKey& key = pcursor->GetKey();
+                const CAddressUnspentValue& value = pcursor->GetValue();
+                UniValue output(UniValue::VOBJ);
+                output.push_back(Pair("address", address));
+                output.push_back(Pair("txid", key.txhash.GetHex()));
+                output.push_back(Pair("outputIndex", (int)key.index));
+                output.push_back(Pair("script", HexStr(value.script.begin(), value.script.end())));
+                output.push_back(Pair("satoshis", value.satoshis));
+                output.push_back(Pair("height", value.blockHeight));
+                utxos.push_back(output);
+            }
+        }
+        return pageResult<CAddressUnspentKey>("utxos", utxos, NULL);
+    }
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -817,6 +941,8 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return at most this many deltas\n"
+            "  \"cursor\" (string, optional) Continue with the page that this cursor of a previous call points to\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -829,8 +955,14 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit):\n"
+            "{\n"
+            "  \"deltas\"  (array) The deltas as above\n"
+            "  \"cursor\"  (string) Pass as cursor to get the next page; not present on the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -849,12 +981,51 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         }
     }
 
+    if (!WaitForIndexSync())
+        throw JSONRPCError(RPC_IN_WARMUP, "Indexes are still catching up with the active chain");
+
     std::vector<std::pair<uint160, int> > addresses;
 
     if (!getAddressesFromParams(request.params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t limit = 0;
+    CAddressIndexKey cursor;
+    std::vector<std::pair<uint160, int> >::const_iterator first;
+    if (getPageFromParams(request.params, addresses, limit, cursor, first)) {
+        UniValue deltas(UniValue::VARR);
+        for (std::vector<std::pair<uint160, int> >::const_iterator it = first; it != addresses.end(); it++) {
+            std::unique_ptr<CAddressIndexCursor> pcursor(GetAddressIndexCursor((*it).first, (*it).second));
+            if (!pcursor) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+            seekAddressIndexCursor(*pcursor, *it, it == first ? &cursor : NULL, start, end);
+
+            std::string address;
+            if (!getAddressFromIndex((*it).second, (*it).first, address)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+            }
+            for (; pcursor->Valid(); pcursor->Next()) {
+                const CAddressIndexKey& key = pcursor->GetKey();
+                if (end > 0 && key.blockHeight > end)
+                    break;
+                if (deltas.size() == limit)
+                    return pageResult("deltas", deltas, &key);
+
+                UniValue delta(UniValue::VOBJ);
+                delta.push_back(Pair("satoshis", pcursor->GetValue()));
+                delta.push_back(Pair("txid", key.txhash.GetHex()));
+                delta.push_back(Pair("index", (int)key.index));
+                delta.push_back(Pair("blockindex", (int)key.txindex));
+                delta.push_back(Pair("height", key.blockHeight));
+                delta.push_back(Pair("address", address));
+                deltas.push_back(delta);
+            }
+        }
+        return pageResult<CAddressIndexKey>("deltas", deltas, NULL);
+    }
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -920,22 +1091,19 @@ UniValue getaddressbalance(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
+    if (!WaitForIndexSync())
+        throw JSONRPCError(RPC_IN_WARMUP, "Indexes are still catching up with the active chain");
 
     CAmount balance = 0;
     CAmount received = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue value;
+        if (!GetAddressBalance((*it).first, (*it).second, value)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+        balance += value.balance;
+        received += value.received;
     }
 
     UniValue result(UniValue::VOBJ);
@@ -961,14 +1129,22 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return at most this many txids\n"
+            "  \"cursor\" (string, optional) Continue with the page that this cursor of a previous call points to\n"
             "}\n"
             "\nResult:\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nResult (with limit):\n"
+            "{\n"
+            "  \"txids\"  (array) The txids, address by address; a transaction is listed once for every address it touches\n"
+            "  \"cursor\"  (string) Pass as cursor to get the next page; not present on the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -978,6 +1154,9 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    if (!WaitForIndexSync())
+        throw JSONRPCError(RPC_IN_WARMUP, "Indexes are still catching up with the active chain");
+
     int start = 0;
     int end = 0;
     if (request.params[0].isObject()) {
@@ -989,6 +1168,37 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         }
     }
 
+    size_t limit = 0;
+    CAddressIndexKey cursor;
+    std::vector<std::pair<uint160, int> >::const_iterator first;
+    if (getPageFromParams(request.params, addresses, limit, cursor, first)) {
+        UniValue txids(UniValue::VARR);
+        for (std::vector<std::pair<uint160, int> >::const_iterator it = first; it != addresses.end(); it++) {
+            std::unique_ptr<CAddressIndexCursor> pcursor(GetAddressIndexCursor((*it).first, (*it).second));
+            if (!pcursor) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+            seekAddressIndexCursor(*pcursor, *it, it == first ? &cursor : NULL, start, end);
+
+            // The deltas of a transaction are adjacent, so a page never ends
+            // within one
+            uint256 lastTxid;
+            for (; pcursor->Valid(); pcursor->Next()) {
+                const CAddressIndexKey& key = pcursor->GetKey();
+                if (end > 0 && key.blockHeight > end)
+                    break;
+                if (key.txhash == lastTxid)
+                    continue;
+                if (txids.size() == limit)
+                    return pageResult("txids", txids, &key);
+
+                txids.push_back(key.txhash.GetHex());
+                lastTxid = key.txhash;
+            }
+        }
+        return pageResult<CAddressIndexKey>("txids", txids, NULL);
+    }
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -1061,6 +1271,9 @@ UniValue getspentinfo(const JSONRPCRequest& request)
     uint256 txid = ParseHashV(txidValue, "txid");
     int outputIndex = indexValue.get_int();
 
+    if (!WaitForIndexSync())
+        throw JSONRPCError(RPC_IN_WARMUP, "Indexes are still catching up with the active chain");
+
     CSpentIndexKey key(txid, outputIndex);
     CSpentIndexValue value;
 
@@ -1089,6 +1302,19 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCBlockIndexMemoryInfo()
+{
+    BlockIndexMemoryStats stats = GetBlockIndexMemoryStats();
+    size_t nUsed = stats.nArenaBytes + stats.nMapBytes;
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("entries", uint64_t(stats.nEntries)));
+    obj.push_back(Pair("entries_bytes", uint64_t(stats.nArenaBytes)));
+    obj.push_back(Pair("map_bytes", uint64_t(stats.nMapBytes)));
+    obj.push_back(Pair("heap_bytes", uint64_t(stats.nHeapBytes)));
+    obj.push_back(Pair("saved_bytes", int64_t(stats.nHeapBytes) - int64_t(nUsed)));
+    return obj;
+}
+
 UniValue getmemoryinfo(const JSONRPCRequest& request)
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
@@ -1107,6 +1333,13 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"blockindex\": {           (json object) Information about the in-memory block index\n"
+            "    \"entries\": xxxxx,       (numeric) Number of block index entries\n"
+            "    \"entries_bytes\": xxxxx, (numeric) Bytes of the slabs holding the entries\n"
+            "    \"map_bytes\": xxxxx,     (numeric) Bytes of the hash map from block hash to entry\n"
+            "    \"heap_bytes\": xxxxx,    (numeric) Estimated bytes the same entries and map would take with one allocation each\n"
+            "    \"saved_bytes\": xxxxx,   (numeric) heap_bytes minus the bytes actually used\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -1115,6 +1348,7 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
         );
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("locked", RPCLockedMemoryInfo()));
+    obj.push_back(Pair("blockindex", RPCBlockIndexMemoryInfo()));
     return obj;
 }
 
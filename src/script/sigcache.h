@@ -32,4 +32,7 @@ public:
 
 void InitSignatureCache();
 
+/** Look a signature up in the cache without verifying it or evicting it */
+bool IsSignatureCached(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
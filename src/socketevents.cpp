@@ -0,0 +1,173 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#include <algorithm>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+/** Maximum number of events taken from the kernel by one epoll_wait() */
+static const int MAX_EPOLL_EVENTS = 1024;
+
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& mode)
+{
+    if (strMode == "select") {
+        mode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        mode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSocketEventsModeName(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SOCKETEVENTS_SELECT: return "select";
+    case SOCKETEVENTS_EPOLL: return "epoll";
+    }
+    return "unknown";
+}
+
+std::string GetSupportedSocketEventsModes()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return "select, epoll";
+#else
+    return "select";
+#endif
+}
+
+CSocketEvents::CSocketEvents(SocketEventsMode modeIn) : mode(SOCKETEVENTS_SELECT), epollfd(-1)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (modeIn == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("epoll_create1 failed: %s, using select() instead\n", NetworkErrorString(WSAGetLastError()));
+        } else {
+            mode = SOCKETEVENTS_EPOLL;
+        }
+    }
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (epollfd != -1)
+        close(epollfd);
+#endif
+}
+
+bool CSocketEvents::Add(SOCKET hSocket, void* pData, bool fEdgeTriggered)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (mode == SOCKETEVENTS_EPOLL) {
+        struct epoll_event event;
+        event.events = fEdgeTriggered ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) : EPOLLIN;
+        event.data.ptr = pData;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &event) != 0) {
+            LogPrintf("epoll_ctl failed to add socket: %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void CSocketEvents::Watch(SOCKET hSocket, void* pData, bool fRecv, bool fSend)
+{
+    if (mode != SOCKETEVENTS_SELECT)
+        return;
+    WatchedSocket watched;
+    watched.hSocket = hSocket;
+    watched.pData = pData;
+    watched.fRecv = fRecv;
+    watched.fSend = fSend;
+    vWatched.push_back(watched);
+}
+
+bool CSocketEvents::Wait(int64_t nTimeoutMs, std::vector<SocketEvent>& vEvents)
+{
+    if (mode == SOCKETEVENTS_EPOLL)
+        return WaitEpoll(nTimeoutMs, vEvents);
+    return WaitSelect(nTimeoutMs, vEvents);
+}
+
+bool CSocketEvents::WaitSelect(int64_t nTimeoutMs, std::vector<SocketEvent>& vEvents)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = nTimeoutMs / 1000;
+    timeout.tv_usec = (nTimeoutMs % 1000) * 1000;
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    for (const WatchedSocket& watched : vWatched) {
+        if (watched.fRecv)
+            FD_SET(watched.hSocket, &fdsetRecv);
+        if (watched.fSend)
+            FD_SET(watched.hSocket, &fdsetSend);
+        FD_SET(watched.hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, watched.hSocket);
+    }
+
+    int nSelect = select(vWatched.empty() ? 0 : hSocketMax + 1,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    bool fSuccess = nSelect != SOCKET_ERROR;
+    if (fSuccess) {
+        for (const WatchedSocket& watched : vWatched) {
+            bool fRecv = FD_ISSET(watched.hSocket, &fdsetRecv);
+            bool fSend = FD_ISSET(watched.hSocket, &fdsetSend);
+            bool fError = FD_ISSET(watched.hSocket, &fdsetError);
+            if (fRecv || fSend || fError)
+                vEvents.push_back(SocketEvent(watched.pData, fRecv, fSend, fError));
+        }
+    } else if (!vWatched.empty()) {
+        LogPrintf("socket select error %s\n", NetworkErrorString(WSAGetLastError()));
+        for (const WatchedSocket& watched : vWatched)
+            vEvents.push_back(SocketEvent(watched.pData, true, false, false));
+    }
+    vWatched.clear();
+    return fSuccess;
+}
+
+bool CSocketEvents::WaitEpoll(int64_t nTimeoutMs, std::vector<SocketEvent>& vEvents)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, nTimeoutMs);
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEINTR)
+            return true;
+        LogPrintf("epoll_wait error %s\n", NetworkErrorString(nErr));
+        return false;
+    }
+    for (int i = 0; i < nEvents; i++) {
+        const struct epoll_event& event = events[i];
+        bool fError = (event.events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+        vEvents.push_back(SocketEvent(event.data.ptr, (event.events & EPOLLIN) != 0, (event.events & EPOLLOUT) != 0, fError));
+    }
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bastoji-config.h"
+#endif
+
+#include "compat.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** How the network thread waits for its sockets to become ready */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+static const SocketEventsMode DEFAULT_SOCKETEVENTS_MODE = SOCKETEVENTS_EPOLL;
+#else
+static const SocketEventsMode DEFAULT_SOCKETEVENTS_MODE = SOCKETEVENTS_SELECT;
+#endif
+
+/** Parse a -socketevents value, returns false if it is unknown or not supported here */
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& mode);
+std::string GetSocketEventsModeName(SocketEventsMode mode);
+/** The -socketevents values supported by this build, for the help message */
+std::string GetSupportedSocketEventsModes();
+
+/** A socket that is ready, as reported by CSocketEvents::Wait() */
+struct SocketEvent
+{
+    void* pData;
+    bool fRecv;
+    bool fSend;
+    bool fError;
+
+    SocketEvent(void* pDataIn, bool fRecvIn, bool fSendIn, bool fErrorIn) :
+        pData(pDataIn), fRecv(fRecvIn), fSend(fSendIn), fError(fErrorIn) {}
+};
+
+/**
+ * Readiness notification for the sockets of the network thread.
+ *
+ * With select() the sockets of interest are given anew with Watch() before
+ * every Wait(), and all of them are scanned on every call.
+ *
+ * With epoll (Linux) a socket is registered once with Add() and stays
+ * registered until it is closed. Edge triggered sockets are watched for both
+ * directions at once and only reported when their state changes, so the
+ * caller has to remember that a socket is readable or writable until a recv()
+ * or send() on it would block. Level triggered sockets (listening sockets)
+ * are reported for as long as they are readable.
+ *
+ * Add() may be called from any thread; Watch() and Wait() only from the thread
+ * that owns the instance.
+ */
+class CSocketEvents
+{
+public:
+    /** Falls back to select() if the requested backend cannot be set up */
+    explicit CSocketEvents(SocketEventsMode modeIn);
+    ~CSocketEvents();
+
+    SocketEventsMode GetMode() const { return mode; }
+
+    /** epoll: start reporting the events of hSocket, tagged with pData */
+    bool Add(SOCKET hSocket, void* pData, bool fEdgeTriggered);
+    /** select(): wait for hSocket in the next Wait(). Errors are always reported */
+    void Watch(SOCKET hSocket, void* pData, bool fRecv, bool fSend);
+    /**
+     * Wait up to nTimeoutMs milliseconds for events and append them to vEvents.
+     * Returns false if waiting failed, in which case the watched sockets of the
+     * select() backend are all reported readable, as the caller did before.
+     */
+    bool Wait(int64_t nTimeoutMs, std::vector<SocketEvent>& vEvents);
+
+private:
+    struct WatchedSocket
+    {
+        SOCKET hSocket;
+        void* pData;
+        bool fRecv;
+        bool fSend;
+    };
+
+    SocketEventsMode mode;
+    int epollfd;
+    std::vector<WatchedSocket> vWatched;
+
+    bool WaitSelect(int64_t nTimeoutMs, std::vector<SocketEvent>& vEvents);
+    bool WaitEpoll(int64_t nTimeoutMs, std::vector<SocketEvent>& vEvents);
+
+    CSocketEvents(const CSocketEvents&);
+    CSocketEvents& operator=(const CSocketEvents&);
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
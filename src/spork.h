@@ -31,7 +31,6 @@ static const int SPORK_START                                            = SPORK_
 static const int SPORK_END                                              = SPORK_14_REQUIRE_SENTINEL_FLAG;
 
 extern std::map<int, int64_t> mapSporkDefaults;
-extern std::map<uint256, CSporkMessage> mapSporks;
 extern CSporkManager sporkManager;
 
 //
@@ -86,7 +85,10 @@ public:
 class CSporkManager
 {
 private:
+    // critical section to protect mapSporks and mapSporksActive, sporks are processed by several message threads
+    mutable CCriticalSection cs;
     std::vector<unsigned char> vchSig;
+    std::map<uint256, CSporkMessage> mapSporks;
     std::map<int, CSporkMessage> mapSporksActive;
 
     CKeyID sporkPubKeyID;
@@ -100,6 +102,7 @@ public:
     void ExecuteSpork(int nSporkID, int nValue);
     bool UpdateSpork(int nSporkID, int64_t nValue, CConnman& connman);
 
+    bool GetSporkByHash(const uint256& hash, CSporkMessage &sporkRet);
     bool IsSporkActive(int nSporkID);
     int64_t GetSporkValue(int nSporkID);
     int GetSporkIDByName(const std::string& strName);
@@ -0,0 +1,185 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Arena for many small, equally sized allocations, such as the nodes of a
+ * node based container.
+ *
+ * Blocks are carved out of large chunks and freed blocks are kept in a free
+ * list per size class for reuse. Chunk memory is only handed back to the system
+ * when the resource itself is destroyed, which releases everything in one go
+ * instead of one free() per element. Requests that are too large or too
+ * strictly aligned for the pool (e.g. hash table bucket arrays) are passed on
+ * to operator new.
+ *
+ * Not thread safe; guard it with the lock of the container that uses it.
+ */
+class PoolResource
+{
+public:
+    static const size_t ALIGN_BYTES = alignof(std::max_align_t);
+    static const size_t MAX_BLOCK_SIZE_BYTES = 256;
+    static const size_t CHUNK_SIZE_BYTES = 256 * 1024;
+
+private:
+    struct ListNode {
+        ListNode* next;
+    };
+
+    //! Free lists, indexed by block size in units of ALIGN_BYTES
+    std::vector<ListNode*> vFreeLists;
+    //! All chunks allocated so far
+    std::vector<void*> vChunks;
+    //! Untouched part of the most recent chunk
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+    //! Bytes currently handed out through operator new
+    size_t nLargeBytes;
+
+    static size_t NumAlignUnits(size_t bytes)
+    {
+        return (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    static bool IsPoolable(size_t bytes, size_t alignment)
+    {
+        return bytes > 0 && bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ALIGN_BYTES;
+    }
+
+    void PushFree(void* p, size_t nUnits)
+    {
+        ListNode* node = static_cast<ListNode*>(p);
+        node->next = vFreeLists[nUnits];
+        vFreeLists[nUnits] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // Whatever is left of the current chunk is smaller than a block, keep it for later
+        size_t nRemaining = pAvailableEnd - pAvailableBegin;
+        if (nRemaining > 0) {
+            PushFree(pAvailableBegin, nRemaining / ALIGN_BYTES);
+        }
+        void* p = ::operator new(CHUNK_SIZE_BYTES);
+        vChunks.push_back(p);
+        pAvailableBegin = static_cast<char*>(p);
+        pAvailableEnd = pAvailableBegin + CHUNK_SIZE_BYTES;
+    }
+
+public:
+    PoolResource() : vFreeLists(MAX_BLOCK_SIZE_BYTES / ALIGN_BYTES + 1, nullptr), pAvailableBegin(nullptr), pAvailableEnd(nullptr), nLargeBytes(0) {}
+
+    ~PoolResource()
+    {
+        for (void* p : vChunks) {
+            ::operator delete(p);
+        }
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        if (!IsPoolable(bytes, alignment)) {
+            void* p = ::operator new(bytes);
+            nLargeBytes += bytes;
+            return p;
+        }
+        size_t nUnits = NumAlignUnits(bytes);
+        if (vFreeLists[nUnits] != nullptr) {
+            ListNode* node = vFreeLists[nUnits];
+            vFreeLists[nUnits] = node->next;
+            return node;
+        }
+        size_t nBlockBytes = nUnits * ALIGN_BYTES;
+        if ((size_t)(pAvailableEnd - pAvailableBegin) < nBlockBytes) {
+            AllocateChunk();
+        }
+        void* p = pAvailableBegin;
+        pAvailableBegin += nBlockBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment)
+    {
+        if (!IsPoolable(bytes, alignment)) {
+            nLargeBytes -= bytes;
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumAlignUnits(bytes));
+    }
+
+    size_t NumChunks() const { return vChunks.size(); }
+    size_t LargeBytes() const { return nLargeBytes; }
+};
+
+/**
+ * Allocator handing out memory from a PoolResource. A default constructed
+ * allocator has no resource and simply uses operator new, so containers using
+ * it can still be created without an arena.
+ *
+ * The allocator moves along with a container on move assignment and swap.
+ * Copies of a container never share its arena.
+ */
+template <typename T>
+class PoolAllocator
+{
+    PoolResource* resource;
+
+    template <typename U>
+    friend class PoolAllocator;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    PoolAllocator() noexcept : resource(nullptr) {}
+    explicit PoolAllocator(PoolResource* resourceIn) noexcept : resource(resourceIn) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : resource(other.resource) {}
+
+    PoolAllocator select_on_container_copy_construction() const { return PoolAllocator(); }
+
+    T* allocate(size_t n)
+    {
+        if (resource == nullptr) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (resource == nullptr) {
+            ::operator delete(p);
+            return;
+        }
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    PoolResource* GetResource() const { return resource; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return resource == other.resource; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return resource != other.resource; }
+};
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -9,6 +9,7 @@
 #include "support/cleanse.h"
 
 #include <memory>
+#include <type_traits>
 #include <vector>
 
 template <typename T>
@@ -22,10 +23,19 @@ struct zero_after_free_allocator : public std::allocator<T> {
     typedef typename base::reference reference;
     typedef typename base::const_reference const_reference;
     typedef typename base::value_type value_type;
-    zero_after_free_allocator() throw() {}
-    zero_after_free_allocator(const zero_after_free_allocator& a) throw() : base(a) {}
+    // Buffers keep the allocator they were made with when swapped or moved
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    /** Whether memory is zeroed before it is released */
+    bool fCleanse;
+
+    zero_after_free_allocator() throw() : fCleanse(true) {}
+    explicit zero_after_free_allocator(bool fCleanseIn) throw() : fCleanse(fCleanseIn) {}
+    zero_after_free_allocator(const zero_after_free_allocator& a) throw() : base(a), fCleanse(a.fCleanse) {}
     template <typename U>
-    zero_after_free_allocator(const zero_after_free_allocator<U>& a) throw() : base(a)
+    zero_after_free_allocator(const zero_after_free_allocator<U>& a) throw() : base(a), fCleanse(a.fCleanse)
     {
     }
     ~zero_after_free_allocator() throw() {}
@@ -36,10 +46,19 @@ struct zero_after_free_allocator : public std::allocator<T> {
 
     void deallocate(T* p, std::size_t n)
     {
-        if (p != NULL)
+        if (p != NULL && fCleanse)
             memory_cleanse(p, sizeof(T) * n);
         std::allocator<T>::deallocate(p, n);
     }
+
+    // Copies of a buffer are zeroed again, whatever the original was made with
+    zero_after_free_allocator select_on_container_copy_construction() const throw() { return zero_after_free_allocator(); }
+
+    // Memory of one can be released by the other, whether it is zeroed or not
+    template <typename U>
+    bool operator==(const zero_after_free_allocator<U>&) const throw() { return true; }
+    template <typename U>
+    bool operator!=(const zero_after_free_allocator<U>&) const throw() { return false; }
 };
 
 // Byte-vector that clears its contents before deletion.
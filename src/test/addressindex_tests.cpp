@@ -0,0 +1,243 @@
+// Copyright (c) 2018 The Bastoji Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "indexdb.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "spentindex.h"
+#include "txdb.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+#include "test/test_bastoji.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+static std::pair<CAddressIndexKey, CAmount> Delta(const uint160& address, int height, const uint256& txid, size_t n, bool spending, CAmount amount)
+{
+    return std::make_pair(CAddressIndexKey(1, address, height, 1, txid, n, spending), amount);
+}
+
+static void CheckBalance(CIndexDB& db, const uint160& address, CAmount balance, CAmount received, unsigned int txCount, int lastHeight)
+{
+    CAddressBalanceValue value;
+    BOOST_CHECK(db.ReadAddressBalance(address, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, balance);
+    BOOST_CHECK_EQUAL(value.received, received);
+    BOOST_CHECK_EQUAL(value.txCount, txCount);
+    BOOST_CHECK_EQUAL(value.lastHeight, lastHeight);
+}
+
+BOOST_AUTO_TEST_CASE(address_balance_index)
+{
+    CIndexDB db(1 << 20, true);
+    uint160 address = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint160 other = uint160(ParseHex("1413121110090807060504030201000f0e0d0c0b"));
+    uint256 tx1 = uint256S("0x01");
+    uint256 tx2 = uint256S("0x02");
+    uint256 tx3 = uint256S("0x03");
+
+    // Block 10 pays the address twice in one transaction
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block10;
+    block10.push_back(Delta(address, 10, tx1, 0, false, 5 * COIN));
+    block10.push_back(Delta(address, 10, tx1, 1, false, 3 * COIN));
+    block10.push_back(Delta(other, 10, tx1, 2, false, 1 * COIN));
+    BOOST_CHECK(db.WriteAddressIndex(block10));
+    CheckBalance(db, address, 8 * COIN, 8 * COIN, 1, 10);
+
+    // Block 12 spends one output and sends change back
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block12;
+    block12.push_back(Delta(address, 12, tx2, 0, true, -5 * COIN));
+    block12.push_back(Delta(address, 12, tx2, 1, false, 2 * COIN));
+    block12.push_back(Delta(address, 12, tx3, 0, false, 1 * COIN));
+    BOOST_CHECK(db.WriteAddressIndex(block12));
+    CheckBalance(db, address, 6 * COIN, 11 * COIN, 3, 12);
+
+    // Writing the same deltas again must not count them twice
+    BOOST_CHECK(db.WriteAddressIndex(block12));
+    CheckBalance(db, address, 6 * COIN, 11 * COIN, 3, 12);
+
+    // Disconnecting block 12 goes back to the state after block 10
+    BOOST_CHECK(db.EraseAddressIndex(block12));
+    CheckBalance(db, address, 8 * COIN, 8 * COIN, 1, 10);
+    BOOST_CHECK(db.EraseAddressIndex(block12));
+    CheckBalance(db, address, 8 * COIN, 8 * COIN, 1, 10);
+
+    // An address without deltas has no record
+    BOOST_CHECK(db.EraseAddressIndex(block10));
+    CAddressBalanceValue value;
+    BOOST_CHECK(!db.ReadAddressBalance(address, 1, value));
+    BOOST_CHECK(!db.ReadAddressBalance(other, 1, value));
+}
+
+BOOST_AUTO_TEST_CASE(address_balance_index_upgrade)
+{
+    CIndexDB db(1 << 20, true);
+    uint160 address = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint160 other = uint160(ParseHex("1413121110090807060504030201000f0e0d0c0b"));
+
+    // An address index written without balance records
+    for (int height = 1; height <= 100; height++) {
+        uint256 txid = ArithToUint256(arith_uint256(height));
+        db.Write(std::make_pair('a', Delta(address, height, txid, 0, false, 2 * COIN).first), 2 * COIN);
+        db.Write(std::make_pair('a', Delta(address, height, txid, 1, true, -1 * COIN).first), -1 * COIN);
+        if (height % 10 == 0)
+            db.Write(std::make_pair('a', Delta(other, height, txid, 0, false, COIN).first), COIN);
+    }
+    CAddressBalanceValue value;
+    BOOST_CHECK(!db.ReadAddressBalance(address, 1, value));
+
+    BOOST_CHECK(db.UpgradeAddressBalanceIndex());
+    CheckBalance(db, address, 100 * COIN, 200 * COIN, 100, 100);
+    CheckBalance(db, other, 10 * COIN, 10 * COIN, 10, 100);
+    bool fUpgraded = false;
+    BOOST_CHECK(db.ReadFlag("addressbalanceindex", fUpgraded) && fUpgraded);
+
+    // The records are maintained from then on
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block101;
+    block101.push_back(Delta(address, 101, uint256S("0x65"), 0, true, -100 * COIN));
+    BOOST_CHECK(db.WriteAddressIndex(block101));
+    CheckBalance(db, address, 0, 200 * COIN, 101, 101);
+    BOOST_CHECK(db.EraseAddressIndex(block101));
+    CheckBalance(db, address, 100 * COIN, 200 * COIN, 100, 100);
+}
+
+BOOST_AUTO_TEST_CASE(index_db_connect_disconnect)
+{
+    CIndexDB db(1 << 20, true);
+    bool fAddressIndexOld = fAddressIndex;
+    bool fSpentIndexOld = fSpentIndex;
+    bool fTimestampIndexOld = fTimestampIndex;
+    fAddressIndex = fSpentIndex = fTimestampIndex = true;
+
+    uint160 address = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint160 script = uint160(ParseHex("1413121110090807060504030201000f0e0d0c0b"));
+    CScript scriptAddress = CScript() << OP_DUP << OP_HASH160 << ToByteVector(address) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptScript = CScript() << OP_HASH160 << ToByteVector(script) << OP_EQUAL;
+
+    // tx1 spends a P2SH output of block 7 to the address, tx2 spends that on
+    // to the script again within the same block
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(1 * COIN, scriptAddress));
+    CMutableTransaction tx1;
+    tx1.vin.push_back(CTxIn(COutPoint(uint256S("0xaa"), 0)));
+    tx1.vout.push_back(CTxOut(4 * COIN, scriptAddress));
+    CMutableTransaction tx2;
+    tx2.vin.push_back(CTxIn(COutPoint(tx1.GetHash(), 0)));
+    tx2.vout.push_back(CTxOut(3 * COIN, scriptScript));
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(tx1));
+    block.vtx.push_back(MakeTransactionRef(tx2));
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(2);
+    blockundo.vtxundo[0].vprevout.push_back(Coin(CTxOut(5 * COIN, scriptScript), 7, false));
+    blockundo.vtxundo[1].vprevout.push_back(Coin(tx1.vout[0], 10, false));
+
+    uint256 hashPrev = uint256S("0x09");
+    uint256 hash = uint256S("0x0a");
+    CBlockIndex indexPrev;
+    indexPrev.phashBlock = &hashPrev;
+    indexPrev.nHeight = 9;
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    index.pprev = &indexPrev;
+    index.nHeight = 10;
+    index.nTime = 1500000000;
+
+    BOOST_CHECK(db.ConnectBlock(block, blockundo, &index));
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest) && hashBest == hash);
+    CheckBalance(db, address, 1 * COIN, 5 * COIN, 3, 10);
+
+    // Only the coinbase output is left unspent at the address
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1U);
+    BOOST_CHECK(unspent[0].first.txhash == coinbase.GetHash());
+    unspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(script, 2, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1U);
+    BOOST_CHECK(unspent[0].first.txhash == tx2.GetHash());
+
+    CSpentIndexKey spentKey(uint256S("0xaa"), 0);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(db.ReadSpentIndex(spentKey, spentValue));
+    BOOST_CHECK(spentValue.txid == tx1.GetHash());
+    BOOST_CHECK_EQUAL(spentValue.blockHeight, 10);
+    BOOST_CHECK_EQUAL(spentValue.satoshis, 5 * COIN);
+    BOOST_CHECK_EQUAL(spentValue.addressType, 2);
+    BOOST_CHECK(spentValue.addressHash == script);
+
+    std::vector<uint256> hashes;
+    BOOST_CHECK(db.ReadTimestampIndex(1500000000, 1400000000, hashes));
+    BOOST_CHECK_EQUAL(hashes.size(), 1U);
+
+    // Disconnecting restores the spent output and removes everything else
+    BOOST_CHECK(db.DisconnectBlock(block, blockundo, &index));
+    BOOST_CHECK(db.ReadBestBlock(hashBest) && hashBest == hashPrev);
+    CAddressBalanceValue value;
+    BOOST_CHECK(!db.ReadAddressBalance(address, 1, value));
+    unspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, unspent));
+    BOOST_CHECK(unspent.empty());
+    BOOST_CHECK(db.ReadAddressUnspentIndex(script, 2, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1U);
+    BOOST_CHECK(unspent[0].first.txhash == uint256S("0xaa"));
+    BOOST_CHECK_EQUAL(unspent[0].second.satoshis, 5 * COIN);
+    BOOST_CHECK_EQUAL(unspent[0].second.blockHeight, 7);
+    BOOST_CHECK(!db.ReadSpentIndex(spentKey, spentValue));
+    hashes.clear();
+    BOOST_CHECK(db.ReadTimestampIndex(1500000000, 1400000000, hashes));
+    BOOST_CHECK(hashes.empty());
+
+    fAddressIndex = fAddressIndexOld;
+    fSpentIndex = fSpentIndexOld;
+    fTimestampIndex = fTimestampIndexOld;
+}
+
+BOOST_AUTO_TEST_CASE(index_db_upgrade)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    CIndexDB db(1 << 20, true);
+    uint160 address = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint256 tx1 = uint256S("0x01");
+    uint256 tx2 = uint256S("0x02");
+
+    // Indexes as an older version left them in the block tree database
+    CAddressIndexKey addressKey = Delta(address, 10, tx1, 0, false, 2 * COIN).first;
+    BOOST_CHECK(blocktree.Write(std::make_pair('a', addressKey), 2 * COIN));
+    BOOST_CHECK(blocktree.Write(std::make_pair('p', CSpentIndexKey(tx1, 0)), CSpentIndexValue(tx2, 0, 11, 2 * COIN, 1, address)));
+    BOOST_CHECK(blocktree.WriteFlag("txindex", true));
+
+    uint256 hashBest;
+    BOOST_CHECK(!db.ReadBestBlock(hashBest));
+    BOOST_CHECK(db.Upgrade(blocktree, uint256S("0x0b")));
+    BOOST_CHECK(db.ReadBestBlock(hashBest) && hashBest == uint256S("0x0b"));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 1U);
+    CSpentIndexKey spentKey(tx1, 0);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(db.ReadSpentIndex(spentKey, spentValue));
+    BOOST_CHECK(spentValue.txid == tx2);
+
+    // The entries are gone from the block tree database, everything else stays
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('a', addressKey)));
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('p', spentKey)));
+    bool fTxIndex = false;
+    BOOST_CHECK(blocktree.ReadFlag("txindex", fTxIndex) && fTxIndex);
+
+    BOOST_CHECK(db.UpgradeAddressBalanceIndex());
+    CheckBalance(db, address, 2 * COIN, 2 * COIN, 1, 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
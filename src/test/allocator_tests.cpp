@@ -4,9 +4,12 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_bastoji.h"
 
+#include <unordered_map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +234,52 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(poolresource_tests)
+{
+    PoolResource resource;
+    BOOST_CHECK(resource.NumChunks() == 0);
+
+    // Freed blocks are reused for blocks of the same size class
+    void *a0 = resource.Allocate(24, 8);
+    void *a1 = resource.Allocate(24, 8);
+    BOOST_CHECK(a0 != a1);
+    BOOST_CHECK(resource.NumChunks() == 1);
+    resource.Deallocate(a0, 24, 8);
+    BOOST_CHECK(resource.Allocate(24, 8) == a0);
+    BOOST_CHECK(resource.Allocate(24, 8) != a0);
+
+    // Oversized allocations bypass the arena
+    void *b0 = resource.Allocate(PoolResource::MAX_BLOCK_SIZE_BYTES + 1, 8);
+    BOOST_CHECK(resource.LargeBytes() == PoolResource::MAX_BLOCK_SIZE_BYTES + 1);
+    resource.Deallocate(b0, PoolResource::MAX_BLOCK_SIZE_BYTES + 1, 8);
+    BOOST_CHECK(resource.LargeBytes() == 0);
+
+    // Filling more than a chunk takes another one
+    for (size_t i = 0; i < PoolResource::CHUNK_SIZE_BYTES / PoolResource::MAX_BLOCK_SIZE_BYTES; i++) {
+        BOOST_CHECK(resource.Allocate(PoolResource::MAX_BLOCK_SIZE_BYTES, 8));
+    }
+    BOOST_CHECK(resource.NumChunks() == 2);
+
+    // Containers using the arena behave like regular ones
+    typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int> > > PoolMap;
+    PoolResource mapResource;
+    PoolMap map(0, std::hash<int>(), std::equal_to<int>(), PoolMap::allocator_type(&mapResource));
+    for (int i = 0; i < 10000; i++) {
+        map[i] = i * 2;
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        map.erase(i);
+    }
+    BOOST_CHECK(map.size() == 5000);
+    for (int i = 1; i < 10000; i += 2) {
+        BOOST_CHECK(map.at(i) == i * 2);
+    }
+    BOOST_CHECK(mapResource.NumChunks() > 0);
+
+    // Copies of a pooled map do not share its arena
+    PoolMap mapCopy(map);
+    BOOST_CHECK(mapCopy.get_allocator().GetResource() == nullptr);
+    BOOST_CHECK(mapCopy == map);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -16,6 +17,7 @@
 #include <map>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out);
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
@@ -771,6 +773,38 @@ BOOST_AUTO_TEST_CASE(ccoins_add)
     CheckAddCoin(VALUE2, VALUE3, VALUE3, DIRTY|FRESH, DIRTY|FRESH, true );
 }
 
+void CheckCacheBaseCoin(CAmount cache_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(VALUE1, cache_value, cache_flags);
+
+    Coin coin;
+    BOOST_CHECK(test.base.GetCoin(OUTPOINT, coin));
+    test.cache.CacheBaseCoin(OUTPOINT, std::move(coin));
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_cachebase)
+{
+    /* Check CacheBaseCoin behavior, handing a cache view the coin of its base
+     * view, and checking the resulting entry in the cache. Existing entries
+     * must never be replaced.
+     *
+     *                 Cache   Result  Cache        Result
+     *                 Value   Value   Flags        Flags
+     */
+    CheckCacheBaseCoin(ABSENT, VALUE1, NO_ENTRY   , 0          );
+    CheckCacheBaseCoin(PRUNED, PRUNED, 0          , 0          );
+    CheckCacheBaseCoin(PRUNED, PRUNED, DIRTY      , DIRTY      );
+    CheckCacheBaseCoin(VALUE2, VALUE2, 0          , 0          );
+    CheckCacheBaseCoin(VALUE2, VALUE2, DIRTY      , DIRTY      );
+}
+
 void CheckWriteCoins(CAmount parent_value, CAmount child_value, CAmount expected_value, char parent_flags, char child_flags, char expected_flags)
 {
     SingleEntryCacheTest test(ABSENT, parent_value, parent_flags);
@@ -856,4 +890,55 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(ccoins_background_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewBackgroundFlush flushview(&db);
+    CCoinsViewCache cache(&flushview);
+    boost::thread threadFlush(&CCoinsViewBackgroundFlush::ThreadFlush, &flushview);
+    flushview.WaitForThread();
+
+    COutPoint outpoint1(GetRandHash(), 0);
+    COutPoint outpoint2(GetRandHash(), 1);
+    uint256 hashBlock1 = GetRandHash();
+    uint256 hashBlock2 = GetRandHash();
+
+    // A FRESH coin spent before the flush never reaches the database
+    cache.AddCoin(outpoint1, Coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false), false);
+    cache.AddCoin(outpoint2, Coin(CTxOut(VALUE2, CScript() << OP_TRUE), 1, false), false);
+    cache.SpendCoin(outpoint2);
+    cache.SetBestBlock(hashBlock1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(flushview.GetBackgroundFlushCount(), 1U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+
+    // The flushed state is readable whether or not the write has landed yet
+    BOOST_CHECK(cache.HaveCoin(outpoint1));
+    BOOST_CHECK(!cache.HaveCoin(outpoint2));
+    BOOST_CHECK(flushview.GetBestBlock() == hashBlock1);
+
+    // The next flush waits for the first one
+    cache.SpendCoin(outpoint1);
+    cache.SetBestBlock(hashBlock2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(flushview.GetBackgroundFlushCount(), 2U);
+    BOOST_CHECK(!cache.HaveCoin(outpoint1));
+    BOOST_CHECK(flushview.GetBestBlock() == hashBlock2);
+
+    BOOST_CHECK(flushview.Sync());
+    BOOST_CHECK(!db.HaveCoin(outpoint1));
+    BOOST_CHECK(!db.HaveCoin(outpoint2));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+
+    // Once the flush thread is gone, flushes are written directly
+    threadFlush.interrupt();
+    threadFlush.join();
+    cache.AddCoin(outpoint1, Coin(CTxOut(VALUE1, CScript() << OP_TRUE), 2, false), false);
+    cache.SetBestBlock(hashBlock1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(flushview.GetBackgroundFlushCount(), 2U);
+    BOOST_CHECK(db.HaveCoin(outpoint1));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
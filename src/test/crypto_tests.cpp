@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "crypto/aes.h"
+#include "crypto/Lyra2RE/Lyra2RE.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -462,4 +464,21 @@ BOOST_AUTO_TEST_CASE(pbkdf2_hmac_sha512_test) {
     BOOST_CHECK(HexStr(k, k + 64) == "8c0511f4c6e597c6ac6315d8f0362e225f3c501495ba23b868c005174dc4ee71115b59f9e60cd9532fa33e0f75aefe30225c583a186cd82bd4daea9724a3d3b8");
 }
 
+BOOST_AUTO_TEST_CASE(lyra2_sponge_implementations) {
+    // Every sponge implementation available on this CPU must agree with the
+    // portable one and reproduce the main network genesis block hash.
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    const CBlockHeader genesis = params.GenesisBlock().GetBlockHeader();
+    const int impls[] = {LYRA2_SPONGE_GENERIC, LYRA2_SPONGE_SSE2, LYRA2_SPONGE_AVX2};
+    for (int impl : impls) {
+        if (!Lyra2SpongeSetImplementation(impl))
+            continue;
+        BOOST_CHECK(Lyra2SpongeSelfTest());
+        uint256 hash;
+        lyra2re2_hash(BEGIN(genesis.nVersion), BEGIN(hash));
+        BOOST_CHECK_EQUAL(hash.GetHex(), params.GetConsensus().hashGenesisBlock.GetHex());
+    }
+    Lyra2SpongeAutoDetect();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -320,4 +320,38 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    CDBOptions opts;
+    std::string strError;
+    BOOST_CHECK(opts.Parse("", strError));
+    BOOST_CHECK_EQUAL(opts.ToString(), "compression=0,maxopenfiles=64,bloombits=10,blockcache=50,blocksize=4096");
+    BOOST_CHECK(opts.Parse("compression=1,maxopenfiles=500,bloombits=0,blockcache=75,blocksize=16384", strError));
+    BOOST_CHECK_EQUAL(opts.ToString(), "compression=1,maxopenfiles=500,bloombits=0,blockcache=75,blocksize=16384");
+
+    BOOST_CHECK(!opts.Parse("compression", strError));
+    BOOST_CHECK(!opts.Parse("maxopenfiles=8", strError));
+    BOOST_CHECK(!opts.Parse("blockcache=-1", strError));
+    BOOST_CHECK(!opts.Parse("cachesize=10", strError));
+
+    // A database with a non-default profile stores and reads back as usual.
+    // Without Snappy, which the bundled LevelDB is built without by default,
+    // it reports compression as off.
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, opts);
+    CDBOptions optsInEffect = opts;
+#ifndef SNAPPY
+    optsInEffect.fCompression = false;
+#endif
+    BOOST_CHECK_EQUAL(dbw.GetDBOptions().ToString(), optsInEffect.ToString());
+    uint256 in = GetRandHash();
+    uint256 res;
+    BOOST_CHECK(dbw.Write('k', in));
+    BOOST_CHECK(dbw.Read('k', res));
+    BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+    std::string strStats;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", strStats));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonexistent", strStats));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,11 +3,15 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "primitives/block.h"
 #include "utilstrencodings.h"
 #include "test/test_bastoji.h"
 
+#include <atomic>
 #include <vector>
 
+#include <boost/thread.hpp>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(hash_tests, BasicTestingSetup)
@@ -149,4 +153,74 @@ BOOST_AUTO_TEST_CASE(siphash)
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
 }
 
+BOOST_AUTO_TEST_CASE(blockheader_hash_cache)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = uint256S("000000000000000000000000000000000000000000000000000000000000abcd");
+    header.hashMerkleRoot = uint256S("0000000000000000000000000000000000000000000000000000000000001234");
+    header.nTime = 1514764800;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 42;
+
+    uint256 expected;
+    lyra2re2_hash(BEGIN(header.nVersion), BEGIN(expected));
+    BOOST_CHECK(header.GetHash() == expected);
+    // Cached result
+    BOOST_CHECK(header.GetHash() == expected);
+
+    // Changing any field must invalidate the cached hash
+    header.nNonce++;
+    uint256 expectedNonce;
+    lyra2re2_hash(BEGIN(header.nVersion), BEGIN(expectedNonce));
+    BOOST_CHECK(expectedNonce != expected);
+    BOOST_CHECK(header.GetHash() == expectedNonce);
+
+    header.hashMerkleRoot = uint256S("0000000000000000000000000000000000000000000000000000000000005678");
+    uint256 expectedMerkle;
+    lyra2re2_hash(BEGIN(header.nVersion), BEGIN(expectedMerkle));
+    BOOST_CHECK(header.GetHash() == expectedMerkle);
+
+    // Copies carry the cache and stay consistent with their own fields
+    CBlock block(header);
+    BOOST_CHECK(block.GetHash() == expectedMerkle);
+    BOOST_CHECK(block.GetBlockHeader().GetHash() == expectedMerkle);
+    block.nNonce--;
+    block.hashMerkleRoot = uint256S("0000000000000000000000000000000000000000000000000000000000001234");
+    BOOST_CHECK(block.GetHash() == expected);
+    BOOST_CHECK(header.GetHash() == expectedMerkle);
+
+    header.SetNull();
+    uint256 hashCached;
+    BOOST_CHECK(!header.GetCachedHash(hashCached));
+}
+
+BOOST_AUTO_TEST_CASE(blockheader_hash_cache_shared)
+{
+    // Threads hashing the same const block fill its cache concurrently and
+    // all see the right hash
+    for (int nRound = 0; nRound < 20; nRound++) {
+        CBlock block;
+        block.nVersion = 4;
+        block.nTime = 1514764800 + nRound;
+        block.nBits = 0x1e0ffff0;
+        uint256 expected;
+        lyra2re2_hash(BEGIN(block.nVersion), BEGIN(expected));
+
+        const CBlock& shared = block;
+        std::atomic<int> nWrong(0);
+        boost::thread_group threads;
+        for (int i = 0; i < 4; i++) {
+            threads.create_thread([&shared, &expected, &nWrong] {
+                for (int j = 0; j < 10; j++) {
+                    if (shared.GetHash() != expected || CBlock(shared).GetHash() != expected)
+                        nWrong++;
+                }
+            });
+        }
+        threads.join_all();
+        BOOST_CHECK_EQUAL(nWrong, 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
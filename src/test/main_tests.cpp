@@ -2,7 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
 #include "net.h"
+#include "netmessagemaker.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "validation.h"
 
 #include "test/test_bastoji.h"
 
@@ -27,4 +36,232 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+struct RegTestingSetup : public TestingSetup {
+    RegTestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+/** Mine a chain of blocks with a coinbase each on top of pindexPrev, the last one with a wrong merkle root if fBadMerkleTip */
+static std::vector<CBlock> CreateChain(const CBlockIndex* pindexPrev, size_t nBlocks, const Consensus::Params& consensusParams, bool fBadMerkleTip = false)
+{
+    std::vector<CBlock> blocks(nBlocks);
+    uint256 hashPrev = pindexPrev->GetBlockHash();
+    for (size_t i = 0; i < blocks.size(); i++) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig = CScript() << (int)(pindexPrev->nHeight + i + 1) << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+        CBlock& block = blocks[i];
+        block.nVersion = 1;
+        block.hashPrevBlock = hashPrev;
+        block.nTime = pindexPrev->nTime + i + 1;
+        block.nBits = pindexPrev->nBits;
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        if (fBadMerkleTip && i + 1 == blocks.size())
+            block.hashMerkleRoot = GetRandHash();
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
+            ++block.nNonce;
+        hashPrev = block.GetHash();
+    }
+    return blocks;
+}
+
+BOOST_FIXTURE_TEST_CASE(process_new_block_headers, RegTestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    const CBlockIndex* pindexGenesis = chainActive.Tip();
+
+    // A batch large enough to be spread over the header check threads
+    std::vector<CBlock> blocks = CreateChain(pindexGenesis, 20, consensusParams);
+    std::vector<CBlockHeader> headers(blocks.begin(), blocks.end());
+
+    // Break the proof of work of the 11th header and everything after it
+    std::vector<CBlockHeader> invalid(headers);
+    invalid[10].nTime += 1000;
+    while (CheckProofOfWork(invalid[10].GetHash(), invalid[10].nBits, consensusParams))
+        ++invalid[10].nNonce;
+
+    CValidationState state;
+    const CBlockIndex* pindexLast = NULL;
+    BOOST_CHECK(!ProcessNewBlockHeaders(invalid, state, chainparams, &pindexLast));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    BOOST_CHECK(pindexLast != NULL && pindexLast->nHeight == 10);
+
+    state = CValidationState();
+    pindexLast = NULL;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(pindexLast != NULL && pindexLast->GetBlockHash() == headers.back().GetHash());
+    BOOST_CHECK_EQUAL(pindexLast->nHeight, (int)headers.size());
+}
+
+BOOST_FIXTURE_TEST_CASE(unload_block_index, RegTestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindexGenesis = chainActive.Tip();
+
+    std::vector<CBlock> blocks = CreateChain(pindexGenesis, 5, chainparams.GetConsensus());
+    std::vector<CBlockHeader> headers(blocks.begin(), blocks.end());
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, chainparams));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), headers.size() + 1);
+    BOOST_CHECK_EQUAL(GetBlockIndexMemoryStats().nEntries, headers.size() + 1);
+
+    // Tearing the index down releases the arena its entries live in
+    UnloadBlockIndex();
+    BOOST_CHECK(mapBlockIndex.empty());
+    BOOST_CHECK_EQUAL(GetBlockIndexMemoryStats().nEntries, 0);
+
+    // and entries can be allocated from it again afterwards
+    BOOST_CHECK(InitBlockIndex(chainparams));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1);
+    BOOST_CHECK_EQUAL(GetBlockIndexMemoryStats().nEntries, 1);
+    BOOST_CHECK(mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock));
+    BOOST_CHECK(!mapBlockIndex.count(headers.back().GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(load_block_index_parallel)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlockTreeDB blocktree(1 << 20, true);
+
+    // A chain of 500 entries with a fork of 20 at height 250. The hashes are
+    // random apart from the top bytes, so they pass the proof of work check
+    // and are spread over the whole key range.
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vIndex(520);
+    std::vector<const CBlockIndex*> vWrite;
+    vHashes.reserve(vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        uint256 hash = GetRandHash();
+        memset(hash.begin() + 24, 0, 8);
+        vHashes.push_back(hash);
+        CBlockIndex& index = vIndex[i];
+        index.phashBlock = &vHashes.back();
+        index.pprev = i == 0 ? NULL : &vIndex[i == 500 ? 249 : i - 1];
+        index.nHeight = index.pprev ? index.pprev->nHeight + 1 : 0;
+        index.nBits = UintToArith256(consensusParams.powLimit).GetCompact();
+        index.nTime = i;
+        vWrite.push_back(&index);
+    }
+    BOOST_CHECK(blocktree.WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, vWrite));
+
+    for (int nThreads : {1, 3, 8}) {
+        std::map<uint256, CBlockIndex> mapLoaded;
+        auto insert = [&mapLoaded](const uint256& hash) -> CBlockIndex* {
+            if (hash.IsNull())
+                return NULL;
+            CBlockIndex* pindex = &mapLoaded[hash];
+            pindex->phashBlock = &mapLoaded.find(hash)->first;
+            return pindex;
+        };
+        BOOST_CHECK(blocktree.LoadBlockIndexGuts(insert, nThreads));
+        BOOST_CHECK_EQUAL(mapLoaded.size(), vIndex.size());
+        for (const CBlockIndex& index : vIndex) {
+            const CBlockIndex& loaded = mapLoaded[index.GetBlockHash()];
+            BOOST_CHECK_EQUAL(loaded.nHeight, index.nHeight);
+            BOOST_CHECK_EQUAL(loaded.nTime, index.nTime);
+            BOOST_CHECK(loaded.pprev == NULL ? index.pprev == NULL : loaded.pprev->GetBlockHash() == index.pprev->GetBlockHash());
+        }
+    }
+
+    // A single entry failing the proof of work check fails the whole load
+    vHashes[300] = uint256S("0xff");
+    memset(vHashes[300].begin() + 24, 0xff, 8);
+    BOOST_CHECK(blocktree.WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, std::vector<const CBlockIndex*>(1, &vIndex[300])));
+    std::map<uint256, CBlockIndex> mapLoaded;
+    BOOST_CHECK(!blocktree.LoadBlockIndexGuts([&mapLoaded](const uint256& hash) { return &mapLoaded[hash]; }, 4));
+}
+
+BOOST_FIXTURE_TEST_CASE(load_external_block_file, RegTestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindexGenesis = chainActive.Tip();
+
+    // A chain of blocks on top of genesis, the last with a wrong merkle root
+    std::vector<CBlock> blocks = CreateChain(pindexGenesis, 12, chainparams.GetConsensus(), true);
+
+    // Write them with junk in between, including a message start with a bad
+    // size and one followed by a block that does not deserialize
+    boost::filesystem::path path = GetDataDir() / "import.dat";
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        unsigned char junk[] = {0x01, 0x02, 0x03};
+        file << FLATDATA(junk) << FLATDATA(chainparams.MessageStart()) << (unsigned int)5;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (i == 3)
+                file << FLATDATA(chainparams.MessageStart()) << (unsigned int)100 << FLATDATA(junk);
+            file << FLATDATA(chainparams.MessageStart()) << (unsigned int)::GetSerializeSize(blocks[i], SER_DISK, CLIENT_VERSION) << blocks[i];
+            file << FLATDATA(junk);
+        }
+    }
+
+    FILE* fileIn = fopen(path.string().c_str(), "rb");
+    BOOST_REQUIRE(fileIn != NULL);
+    BOOST_CHECK(LoadExternalBlockFile(chainparams, fileIn));
+
+    LOCK(cs_main);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        BlockMap::iterator mi = mapBlockIndex.find(blocks[i].GetHash());
+        BOOST_REQUIRE(mi != mapBlockIndex.end());
+        BOOST_CHECK_EQUAL((mi->second->nStatus & BLOCK_HAVE_DATA) != 0, i + 1 != blocks.size());
+        BOOST_CHECK_EQUAL(mi->second->nHeight, (int)i + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(read_raw_block_from_disk)
+{
+    const CChainParams& chainparams = Params();
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+
+    // Two blocks in a block file of their own
+    CBlock block = chainparams.GenesisBlock();
+    CBlock block2 = block;
+    block2.nTime++;
+    CDiskBlockPos pos(1, 0);
+    BOOST_REQUIRE(WriteBlockToDisk(block, pos, chainparams.MessageStart()));
+    CDiskBlockPos pos2(1, pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+    BOOST_REQUIRE(WriteBlockToDisk(block2, pos2, chainparams.MessageStart()));
+
+    uint256 hash = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hash;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+    index.nStatus |= BLOCK_HAVE_DATA;
+
+    // The stored bytes are the payload of the block message
+    std::vector<unsigned char> vBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vBlock, &index));
+    BOOST_CHECK(vBlock == msgMaker.Make(NetMsgType::BLOCK, block).data);
+
+    uint256 hash2 = block2.GetHash();
+    CBlockIndex index2(block2);
+    index2.phashBlock = &hash2;
+    index2.nFile = pos2.nFile;
+    index2.nDataPos = pos2.nPos;
+    index2.nStatus |= BLOCK_HAVE_DATA;
+    BOOST_CHECK(ReadRawBlockFromDisk(vBlock, &index2));
+    BOOST_CHECK(vBlock == msgMaker.Make(NetMsgType::BLOCK, block2).data);
+
+    // Another block at the position of the index entry
+    index2.nDataPos = pos.nPos;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, &index2));
+
+    // Positions that are not the start of a block
+    index.nDataPos = pos.nPos + 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, &index));
+    index.nDataPos = 0;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, &index));
+    index.nDataPos = pos2.nPos + 1000000;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, &index));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
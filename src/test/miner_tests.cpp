@@ -7,6 +7,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "key.h"
 #include "validation.h"
 #include "masternode-payments.h"
 #include "miner.h"
@@ -500,4 +501,70 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+// Sign the single input of tx, which spends a P2PK output of key
+static void SignSpend(CMutableTransaction& tx, const CScript& scriptPubKey, const CKey& key)
+{
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig = CScript() << vchSig;
+}
+
+// Test adding new mempool transactions to an existing template.
+BOOST_FIXTURE_TEST_CASE(CreateNewBlock_incremental_update, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    TestMemPoolEntryHelper entry;
+    BlockAssembler assembler(chainparams);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - 10000;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    SignSpend(tx, coinbaseTxns[0].vout[0].scriptPubKey, coinbaseKey);
+    uint256 hashParentTx = tx.GetHash();
+    mempool.addUnchecked(hashParentTx, entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    CAmount nCoinbaseValue = pblocktemplate->block.vtx[0]->GetValueOut();
+
+    // A child of the transaction in the block gets appended, its fee goes to the coinbase
+    tx.vin[0].prevout.hash = hashParentTx;
+    tx.vout[0].nValue -= 20000;
+    SignSpend(tx, scriptPubKey, coinbaseKey);
+    uint256 hashChildTx = tx.GetHash();
+    mempool.addUnchecked(hashChildTx, entry.Fee(20000).SpendsCoinbase(false).FromTx(tx));
+
+    pblocktemplate = assembler.UpdateNewBlock(std::vector<uint256>(1, hashChildTx));
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashChildTx);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), nCoinbaseValue + 20000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -30000);
+
+    // Nothing new, nothing changes
+    pblocktemplate = assembler.UpdateNewBlock(std::vector<uint256>());
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+
+    // Once a transaction in the block left the mempool the block has to be created again
+    mempool.removeRecursive(tx);
+    BOOST_CHECK(!assembler.UpdateNewBlock(std::vector<uint256>()));
+    BOOST_CHECK(!assembler.UpdateNewBlock(std::vector<uint256>()));
+
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(assembler.UpdateNewBlock(std::vector<uint256>()));
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
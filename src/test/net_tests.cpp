@@ -12,6 +12,10 @@
 #include "netbase.h"
 #include "chainparams.h"
 
+#ifndef WIN32
+#include <sys/socket.h>
+#endif
+
 class CAddrManSerializationMock : public CAddrMan
 {
 public:
@@ -70,6 +74,14 @@ CDataStream AddrmanToStream(CAddrManSerializationMock& _addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+struct CConnmanTest
+{
+    static size_t SocketSendData(const CConnman& connman, CNode* pnode)
+    {
+        return connman.SocketSendData(pnode);
+    }
+};
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(caddrdb_read)
@@ -172,4 +184,144 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+/** Feed a serialized message to a CNetMessage, nChunk bytes at a time */
+static void ReadNetMessage(CNetMessage& msg, const std::vector<unsigned char>& vWire, size_t nChunk)
+{
+    size_t nPos = 0;
+    while (nPos < vWire.size()) {
+        unsigned int nBytes = std::min(nChunk, vWire.size() - nPos);
+        const char* pch = (const char*)&vWire[nPos];
+        int nHandled = msg.in_data ? msg.readData(pch, nBytes) : msg.readHeader(pch, nBytes);
+        BOOST_REQUIRE(nHandled > 0);
+        nPos += nHandled;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_read)
+{
+    std::vector<unsigned char> vPayload(300);
+    for (size_t i = 0; i < vPayload.size(); i++)
+        vPayload[i] = i;
+    uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    CMessageHeader hdr(Params().MessageStart(), "tx", vPayload.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    std::vector<unsigned char> vWire;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vWire, 0, hdr);
+    vWire.insert(vWire.end(), vPayload.begin(), vPayload.end());
+
+    // The header received at once, a byte at a time, and split somewhere
+    // in the middle; the later messages also get the data buffers of the
+    // earlier ones, so receiving them allocates no data buffer
+    const char* pchData = NULL;
+    for (size_t nChunk : {vWire.size(), (size_t)1, (size_t)10}) {
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+        ReadNetMessage(msg, vWire, nChunk);
+        BOOST_REQUIRE(msg.complete());
+        BOOST_CHECK(memcmp(msg.hdr.pchMessageStart, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE) == 0);
+        BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "tx");
+        BOOST_CHECK_EQUAL(msg.hdr.nMessageSize, vPayload.size());
+        BOOST_CHECK(memcmp(msg.hdr.pchChecksum, msg.GetMessageHash().begin(), CMessageHeader::CHECKSUM_SIZE) == 0);
+        BOOST_CHECK(msg.hdr.IsValid(Params().MessageStart()));
+        BOOST_CHECK(std::equal(msg.vRecv.begin(), msg.vRecv.end(), (const char*)vPayload.data()));
+        if (pchData)
+            BOOST_CHECK(msg.vRecv.data() == pchData);
+        pchData = msg.vRecv.data();
+
+        // Moving a message hands over its data buffer instead of copying it
+        CNetMessage msgMoved(std::move(msg));
+        BOOST_CHECK(msgMoved.vRecv.data() == pchData);
+        BOOST_CHECK(msg.vRecv.empty());
+    }
+
+    // Messages too large to be parsed are refused right after the header
+    CMessageHeader hdrLarge(Params().MessageStart(), "tx", MAX_SIZE + 1);
+    std::vector<unsigned char> vWireLarge;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vWireLarge, 0, hdrLarge);
+    CNetMessage msgLarge(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(msgLarge.readHeader((const char*)vWireLarge.data(), vWireLarge.size()) < 0);
+}
+
+#ifndef WIN32
+/** Append everything that can be read from hSocket without blocking to vData */
+static void ReceiveAvailable(int hSocket, std::vector<unsigned char>& vData)
+{
+    unsigned char pchBuf[0x10000];
+    ssize_t nRead;
+    while ((nRead = recv(hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT)) > 0)
+        vData.insert(vData.end(), pchBuf, pchBuf + nRead);
+}
+
+BOOST_AUTO_TEST_CASE(socket_send_data)
+{
+    int sv[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    int nSendBuf = 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &nSendBuf, sizeof(nSendBuf));
+
+    CConnman connman(0, 0);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, sv[0], addr, 0, 0, "", false));
+    LOCK(pnode->cs_vSend);
+
+    // More small entries than one sendmsg call takes: two calls send them all
+    std::vector<unsigned char> vExpected;
+    for (int i = 0; i < 100; i++) {
+        pnode->vSendMsg.push_back(std::vector<unsigned char>(10, (unsigned char)i));
+        pnode->nSendSize += 10;
+        vExpected.insert(vExpected.end(), 10, (unsigned char)i);
+    }
+    BOOST_CHECK_EQUAL(CConnmanTest::SocketSendData(connman, pnode.get()), 1000);
+    BOOST_CHECK_EQUAL(pnode->nSendCalls, 2);
+    BOOST_CHECK(pnode->vSendMsg.empty());
+    BOOST_CHECK_EQUAL(pnode->nSendSize, 0);
+    BOOST_CHECK_EQUAL(pnode->nSendOffset, 0);
+    std::vector<unsigned char> vReceived;
+    ReceiveAvailable(sv[1], vReceived);
+    BOOST_CHECK(vReceived == vExpected);
+
+    // Entries of an odd size make the socket stop in the middle of one
+    for (int i = 0; i < 200; i++) {
+        pnode->vSendMsg.push_back(std::vector<unsigned char>(1001, (unsigned char)i));
+        pnode->nSendSize += 1001;
+        vExpected.insert(vExpected.end(), 1001, (unsigned char)i);
+    }
+    bool fStoppedInEntry = false;
+    while (!pnode->vSendMsg.empty()) {
+        size_t nSent = CConnmanTest::SocketSendData(connman, pnode.get());
+        BOOST_REQUIRE(nSent > 0);
+        // The queue accounts for exactly the bytes that were not sent yet
+        size_t nQueued = 0;
+        for (const CSendBuffer& entry : pnode->vSendMsg)
+            nQueued += entry.size();
+        BOOST_CHECK_EQUAL(pnode->nSendSize, nQueued);
+        if (pnode->nSendOffset > 0) {
+            fStoppedInEntry = true;
+            BOOST_CHECK(pnode->nSendOffset < pnode->vSendMsg.front().size());
+        }
+
+        ReceiveAvailable(sv[1], vReceived);
+        BOOST_CHECK_EQUAL(vReceived.size() + nQueued - pnode->nSendOffset, vExpected.size());
+    }
+    BOOST_CHECK(fStoppedInEntry);
+    BOOST_CHECK_EQUAL(pnode->nSendOffset, 0);
+    BOOST_CHECK(vReceived == vExpected);
+
+    // Data shared with other messages is sent from where it is, and let go once sent
+    std::shared_ptr<const std::vector<unsigned char> > pvchShared = std::make_shared<const std::vector<unsigned char> >(100, 0x55);
+    for (int i = 0; i < 2; i++) {
+        pnode->vSendMsg.emplace_back(pvchShared);
+        pnode->nSendSize += pvchShared->size();
+        vExpected.insert(vExpected.end(), pvchShared->begin(), pvchShared->end());
+    }
+    BOOST_CHECK_EQUAL(pvchShared.use_count(), 3);
+    BOOST_CHECK_EQUAL(CConnmanTest::SocketSendData(connman, pnode.get()), 200);
+    BOOST_CHECK_EQUAL(pvchShared.use_count(), 1);
+    ReceiveAvailable(sv[1], vReceived);
+    BOOST_CHECK(vReceived == vExpected);
+    close(sv[1]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
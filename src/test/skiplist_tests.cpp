@@ -143,4 +143,39 @@ BOOST_AUTO_TEST_CASE(findearliestatleast_test)
         BOOST_CHECK(vBlocksMain[r].GetAncestor(ret->nHeight) == ret);
     }
 }
+
+BOOST_AUTO_TEST_CASE(blockindexarena_test)
+{
+    CBlockIndexArena arena;
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), 0U);
+
+    // Fill one slab and start the next; a chain built in height order lies
+    // contiguously within a slab
+    std::vector<CBlockIndex*> vIndex;
+    CBlockHeader header;
+    for (size_t i = 0; i < CBlockIndexArena::SLAB_SIZE + 10; i++) {
+        header.nTime = i;
+        CBlockIndex* pindex = arena.New(header);
+        pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+        pindex->nHeight = vIndex.size();
+        vIndex.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.Size(), vIndex.size());
+    BOOST_CHECK(arena.DynamicMemoryUsage() >= 2 * CBlockIndexArena::SLAB_SIZE * sizeof(CBlockIndex));
+    for (size_t i = 1; i < CBlockIndexArena::SLAB_SIZE; i++) {
+        BOOST_CHECK(vIndex[i] == vIndex[i - 1] + 1);
+    }
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        BOOST_CHECK_EQUAL(vIndex[i]->nTime, i);
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, (int)i);
+    }
+    BOOST_CHECK(vIndex.back()->GetAncestor(5) == vIndex[5]);
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+    BOOST_CHECK_EQUAL(arena.New()->nHeight, 0);
+    BOOST_CHECK_EQUAL(arena.Size(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
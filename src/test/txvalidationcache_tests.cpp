@@ -9,6 +9,7 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bastoji.h"
 #include "utiltime.h"
@@ -84,4 +85,99 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+static CMutableTransaction
+CreateSpend(const COutPoint& prevout, const CScript& scriptPubKey, const CKey& key, CAmount nValue)
+{
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = prevout;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = nValue;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    return spend;
+}
+
+static bool
+IsSpendSignatureCached(const CMutableTransaction& spend, const CScript& scriptPubKey, const CPubKey& pubkey)
+{
+    // The cache holds the signature without its hash type byte
+    CScript::const_iterator pc = spend.vin[0].scriptSig.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(spend.vin[0].scriptSig.GetOp(pc, opcode, vchSig));
+    vchSig.pop_back();
+    return IsSignatureCached(vchSig, pubkey, SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL));
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_preverify_batch, TestChain100Setup)
+{
+    // Verifying a batch ahead of time must not change which of its
+    // transactions the memory pool accepts.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey badKey;
+    badKey.MakeNewKey(true);
+
+    CMutableTransaction parent = CreateSpend(COutPoint(coinbaseTxns[0].GetHash(), 0), scriptPubKey, coinbaseKey, 11*CENT);
+    CMutableTransaction child = CreateSpend(COutPoint(parent.GetHash(), 0), scriptPubKey, coinbaseKey, 10*CENT);
+    // Only the first coinbase is mature, so the bad signature spends it as well
+    CMutableTransaction badSig = CreateSpend(COutPoint(coinbaseTxns[0].GetHash(), 0), scriptPubKey, badKey, 11*CENT);
+    CMutableTransaction missing = CreateSpend(COutPoint(GetRandHash(), 0), scriptPubKey, coinbaseKey, 11*CENT);
+    CMutableTransaction free = CreateSpend(COutPoint(coinbaseTxns[2].GetHash(), 0), scriptPubKey, coinbaseKey, coinbaseTxns[2].vout[0].nValue);
+
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(parent));
+    vtx.push_back(MakeTransactionRef(child));
+    vtx.push_back(MakeTransactionRef(missing));
+    vtx.push_back(MakeTransactionRef(free));
+
+    BOOST_CHECK(!IsSpendSignatureCached(parent, scriptPubKey, coinbaseKey.GetPubKey()));
+    BOOST_CHECK(!IsSpendSignatureCached(child, scriptPubKey, coinbaseKey.GetPubKey()));
+
+    // The child spends the parent from within the batch; the transaction
+    // with unknown inputs and the one below the relay fee are left out.
+    bool fScriptFailed = true;
+    BOOST_CHECK_EQUAL(PreverifyTransactionBatch(mempool, vtx, &fScriptFailed), 2U);
+    BOOST_CHECK(!fScriptFailed);
+
+    // Their signatures are now in the cache for AcceptToMemoryPool to find
+    BOOST_CHECK(IsSpendSignatureCached(parent, scriptPubKey, coinbaseKey.GetPubKey()));
+    BOOST_CHECK(IsSpendSignatureCached(child, scriptPubKey, coinbaseKey.GetPubKey()));
+
+    // A bad signature is checked in its own batch, since a failing check may
+    // cut the others in its round short, and is not cached. The failure is
+    // reported so that the batches of its peer are not verified ahead again.
+    std::vector<CTransactionRef> vtxBad(1, MakeTransactionRef(badSig));
+    BOOST_CHECK_EQUAL(PreverifyTransactionBatch(mempool, vtxBad, &fScriptFailed), 1U);
+    BOOST_CHECK(fScriptFailed);
+    BOOST_CHECK(!IsSpendSignatureCached(badSig, scriptPubKey, badKey.GetPubKey()));
+
+    // The memory pool still decides on each of them
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(badSig), false, NULL, NULL, true, 0));
+        int nDoS = 0;
+        BOOST_CHECK(state.IsInvalid(nDoS));
+        BOOST_CHECK_EQUAL(nDoS, 100);
+        BOOST_CHECK(state.GetRejectReason().find("mandatory-script-verify-flag-failed") == 0);
+    }
+    BOOST_CHECK(ToMemPool(parent));
+    BOOST_CHECK(ToMemPool(child));
+    BOOST_CHECK(!ToMemPool(missing));
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+
+    // Transactions already in the pool are not checked again, nor is one
+    // that spends an output the pool has already spent.
+    vtx.push_back(MakeTransactionRef(badSig));
+    BOOST_CHECK_EQUAL(PreverifyTransactionBatch(mempool, vtx), 0U);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,20 +11,21 @@
 #include "uint256.h"
 #include "ui_interface.h"
 #include "init.h"
+#include "validation.h"
 
 #include <stdint.h>
 
+#include <algorithm>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
-static const char DB_ADDRESSINDEX = 'a';
-static const char DB_ADDRESSUNSPENTINDEX = 'u';
-static const char DB_TIMESTAMPINDEX = 's';
-static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
+// 'a', 'u', 'A', 's' and 'p' held the address, spent and timestamp indexes
+// before they moved to CIndexDB
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
@@ -55,7 +56,7 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbopts) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, dbopts)
 {
 }
 
@@ -75,6 +76,15 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteCoins(mapCoins, hashBlock, true);
+}
+
+bool CCoinsViewDB::WriteSnapshot(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    // Nothing is erased, so the map is only read
+    return WriteCoins(const_cast<CCoinsMap&>(mapCoins), hashBlock, false);
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -89,7 +99,8 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
         count++;
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase)
+            mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -104,7 +115,202 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB *pdbIn) : pdb(pdbIn), fFrozen(false), fThreadRunning(false), nBackgroundFlushes(0), fWriteFailed(false) {
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush() {
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fThreadRunning)
+        condFlush.wait(lock);
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fFrozen) {
+            CCoinsMap::const_iterator it = mapFrozen.find(outpoint);
+            if (it != mapFrozen.end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    // Outpoints missing from the snapshot are not touched by its write, so the
+    // database has their current state whether or not the write has landed.
+    return pdb->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint &outpoint) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fFrozen) {
+            CCoinsMap::const_iterator it = mapFrozen.find(outpoint);
+            if (it != mapFrozen.end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return pdb->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fFrozen)
+            return hashFrozen;
+    }
+    return pdb->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!Sync()) {
+        // The failed snapshot never reached the database and stays what reads
+        // see, so it takes these changes as well until the node has shut down.
+        boost::unique_lock<boost::mutex> lock(cs);
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CCoinsCacheEntry& entry = mapFrozen[it->first];
+                entry.coin = std::move(it->second.coin);
+                entry.flags = CCoinsCacheEntry::DIRTY;
+            }
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        }
+        if (!hashBlock.IsNull())
+            hashFrozen = hashBlock;
+        return false;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fThreadRunning) {
+            lock.unlock();
+            return pdb->BatchWrite(mapCoins, hashBlock);
+        }
+    }
+
+    // The previous snapshot is on disk, so this view is the database again and
+    // FRESH entries that got spent can be dropped. Everything else that is
+    // dirty is moved into the new snapshot.
+    std::unique_ptr<PoolResource> pResource(new PoolResource());
+    CCoinsMap mapSnapshot(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(pResource.get()));
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if ((it->second.flags & CCoinsCacheEntry::DIRTY) && !((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent())) {
+            CCoinsCacheEntry& entry = mapSnapshot[it->first];
+            entry.coin = std::move(it->second.coin);
+            entry.flags = CCoinsCacheEntry::DIRTY;
+        }
+        CCoinsMap::iterator itOld = it++;
+        mapCoins.erase(itOld);
+    }
+
+    uint256 hashSnapshot = hashBlock.IsNull() ? pdb->GetBestBlock() : hashBlock;
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (!fThreadRunning) {
+        // The flush thread stopped in the meantime
+        lock.unlock();
+        return pdb->BatchWrite(mapSnapshot, hashSnapshot);
+    }
+    mapFrozen.swap(mapSnapshot);
+    pfrozenResource.swap(pResource);
+    hashFrozen = hashSnapshot;
+    fFrozen = true;
+    nBackgroundFlushes++;
+    condFlush.notify_all();
+    return true;
+}
+
+void CCoinsViewBackgroundFlush::WriteFrozen() {
+    // The snapshot is not modified until fFrozen is cleared below, so it is
+    // read here without the lock, concurrently with GetCoin callers.
+    bool fOk = false;
+    try {
+        fOk = pdb->WriteSnapshot(mapFrozen, hashFrozen);
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+
+    if (!fOk) {
+        // Keep the snapshot readable: the database lacks its changes
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fWriteFailed = true;
+            condFlush.notify_all();
+        }
+        AbortNode("Failed to write to coin database");
+        return;
+    }
+
+    // Drop the snapshot outside the lock: the map first, then its arena
+    std::unique_ptr<PoolResource> pResource;
+    CCoinsMap mapDone;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        mapFrozen.swap(mapDone);
+        pfrozenResource.swap(pResource);
+        fFrozen = false;
+        condFlush.notify_all();
+    }
+}
+
+void CCoinsViewBackgroundFlush::ThreadFlush() {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fThreadRunning = true;
+        condFlush.notify_all();
+    }
+    try {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fFrozen || fWriteFailed)
+                    condFlush.wait(lock);
+            }
+            WriteFrozen();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Write the snapshot handed over already; later flushes are written
+        // by their callers.
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fFrozen && !fWriteFailed) {
+            lock.unlock();
+            WriteFrozen();
+            lock.lock();
+        }
+        fThreadRunning = false;
+        condFlush.notify_all();
+        throw;
+    }
+}
+
+void CCoinsViewBackgroundFlush::WaitForThread() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (!fThreadRunning)
+        condFlush.wait(lock);
+}
+
+uint64_t CCoinsViewBackgroundFlush::GetBackgroundFlushCount() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nBackgroundFlushes;
+}
+
+CCoinsViewCursor *CCoinsViewBackgroundFlush::Cursor() const {
+    return pdb->Cursor();
+}
+
+size_t CCoinsViewBackgroundFlush::EstimateSize() const {
+    return pdb->EstimateSize();
+}
+
+bool CCoinsViewBackgroundFlush::Sync() {
+    // Callers need the write on disk, even on an interrupted thread
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fFrozen && !fWriteFailed)
+        condFlush.wait(lock);
+    return !fWriteFailed;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbopts) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, dbopts) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -204,186 +410,125 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(std::make_pair(DB_SPENTINDEX, key), value);
-}
-
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
-        if (it->second.IsNull()) {
-            batch.Erase(std::make_pair(DB_SPENTINDEX, it->first));
-        } else {
-            batch.Write(std::make_pair(DB_SPENTINDEX, it->first), it->second);
-        }
-    }
-    return WriteBatch(batch);
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
 
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
-        if (it->second.IsNull()) {
-            batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
-        } else {
-            batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
-        }
-    }
-    return WriteBatch(batch);
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
-
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+namespace {
 
-    pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+/**
+ * Read the block index entries whose hash starts with a byte in [nBegin, nEnd),
+ * in key order. Only touches the iterator and vEntries, so several ranges can
+ * be read at the same time.
+ */
+bool ReadBlockIndexRange(CDBIterator* pcursor, unsigned int nBegin, unsigned int nEnd, std::vector<std::pair<uint256, CDiskBlockIndex> >& vEntries)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    uint256 start;
+    *start.begin() = nBegin;
+    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, start));
 
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char,CAddressUnspentKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
-            CAddressUnspentValue nValue;
-            if (pcursor->GetValue(nValue)) {
-                unspentOutputs.push_back(std::make_pair(key.second, nValue));
-                pcursor->Next();
-            } else {
-                return error("failed to get address unspent value");
-            }
-        } else {
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd)
             break;
-        }
+        CDiskBlockIndex diskindex;
+        if (!pcursor->GetValue(diskindex))
+            return error("%s: failed to read value", __func__);
+        if (!CheckProofOfWork(key.second, diskindex.nBits, consensusParams))
+            return error("%s: CheckProofOfWork failed: %s", __func__, key.second.ToString());
+        vEntries.push_back(std::make_pair(key.second, diskindex));
+        pcursor->Next();
     }
-
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
-                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
-
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    if (start > 0 && end > 0) {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
-    } else {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
-    }
-
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char,CAddressIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
-            if (end > 0 && key.second.blockHeight > end) {
-                break;
-            }
-            CAmount nValue;
-            if (pcursor->GetValue(nValue)) {
-                addressIndex.push_back(std::make_pair(key.second, nValue));
-                pcursor->Next();
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex, int nThreads)
+{
+    // Split the key range by the first byte of the hash and read the parts in
+    // parallel. Creating and linking the CBlockIndex objects stays serial, as
+    // it goes through mapBlockIndex.
+    nThreads = std::max(1, std::min(nThreads, 256));
+    std::vector<std::vector<std::pair<uint256, CDiskBlockIndex> > > vRanges(nThreads);
+    std::vector<char> vRangeOk(nThreads, 0);
+
+    int64_t nTimeStart = GetTimeMicros();
+    {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++) {
+            unsigned int nBegin = i * 256 / nThreads;
+            unsigned int nEnd = (i + 1) * 256 / nThreads;
+            auto read = [this, i, nBegin, nEnd, &vRanges, &vRangeOk] {
+                std::unique_ptr<CDBIterator> pcursor(NewIterator());
+                vRangeOk[i] = ReadBlockIndexRange(pcursor.get(), nBegin, nEnd, vRanges[i]);
+            };
+            if (i == nThreads - 1) {
+                read();
             } else {
-                return error("failed to get address index value");
+                threads.create_thread(read);
             }
-        } else {
-            break;
         }
+        threads.join_all();
     }
-
-    return true;
-}
-
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(*this);
-    batch.Write(std::make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
-
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
-
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, CTimestampIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_TIMESTAMPINDEX && key.second.timestamp <= high) {
-            hashes.push_back(key.second.blockHash);
-            pcursor->Next();
-        } else {
-            break;
+    size_t nEntries = 0;
+    for (int i = 0; i < nThreads; i++) {
+        if (!vRangeOk[i])
+            return false;
+        nEntries += vRanges[i].size();
+    }
+    int64_t nTimeRead = GetTimeMicros();
+
+    boost::this_thread::interruption_point();
+
+    // Create the entries of mapBlockIndex in height order, so parents are
+    // created before their children and the entries of a chain are allocated
+    // next to each other
+    {
+        std::vector<const std::pair<uint256, CDiskBlockIndex>*> vEntries;
+        vEntries.reserve(nEntries);
+        for (int i = 0; i < nThreads; i++) {
+            for (const std::pair<uint256, CDiskBlockIndex>& entry : vRanges[i])
+                vEntries.push_back(&entry);
         }
+        for (const std::pair<uint256, CDiskBlockIndex>* pentry : SortByHeight(vEntries,
+                 [](const std::pair<uint256, CDiskBlockIndex>* p) { return p->second.nHeight; }))
+            insertBlockIndex(pentry->first);
     }
-
-    return true;
-}
-
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
-    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
-}
-
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
-    char ch;
-    if (!Read(std::make_pair(DB_FLAG, name), ch))
-        return false;
-    fValue = ch == '1';
-    return true;
-}
-
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
-{
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
-
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
-            }
-        } else {
-            break;
+    // Then fill them in, releasing each range once it is done
+    for (int i = 0; i < nThreads; i++) {
+        for (const std::pair<uint256, CDiskBlockIndex>& entry : vRanges[i]) {
+            const CDiskBlockIndex& diskindex = entry.second;
+            // Construct block index object
+            CBlockIndex* pindexNew = insertBlockIndex(entry.first);
+            pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
         }
+        std::vector<std::pair<uint256, CDiskBlockIndex> >().swap(vRanges[i]);
     }
+    int64_t nTimeLink = GetTimeMicros();
 
+    LogPrintf("%s: read %u block index entries in %.2fms using %d threads, linked them in %.2fms\n", __func__,
+        nEntries, (nTimeRead - nTimeStart) * 0.001, nThreads, (nTimeLink - nTimeRead) * 0.001);
     return true;
 }
 
@@ -9,9 +9,10 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
-#include "spentindex.h"
+#include "sync.h"
 
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -32,6 +33,14 @@ static const int64_t nDefaultDbCache = 300;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
 static const int64_t nMinDbCache = 4;
+//! max number of threads reading the block index at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+//! -chainstatedbopts default
+static const char* const DEFAULT_CHAINSTATEDB_OPTS = "";
+//! -indexdbopts default (compression=1 only helps with a LevelDB built with Snappy, which the bundled one is not)
+static const char* const DEFAULT_INDEXDB_OPTS = "";
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
 //! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
 static const int64_t nMaxBlockDBCache = 2;
 //! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
@@ -72,7 +81,7 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CDBWrapper db;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbopts = CDBOptions());
 
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
@@ -81,9 +90,74 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Write the dirty entries of mapCoins like BatchWrite, but leave the map untouched so other threads can keep reading it
+    bool WriteSnapshot(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    const CDBWrapper& GetDB() const { return db; }
+
+private:
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+};
+
+/**
+ * CCoinsView on top of the coin database that can take flushes of the cache
+ * above it off the caller's thread. While ThreadFlush() runs, BatchWrite moves
+ * the dirty entries into a frozen snapshot and returns; the flush thread
+ * writes the snapshot to disk, in one batch together with its best block
+ * marker, while reads keep seeing it here. Only one snapshot is in flight at a
+ * time: the next BatchWrite waits for the previous one to be written. Without
+ * the thread, writes go straight to the database.
+ *
+ * If writing a snapshot fails the node is aborted. The snapshot is kept, and
+ * later flushes are added to it, so that reads stay consistent until shutdown.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsView
+{
+private:
+    CCoinsViewDB *pdb;
+
+    mutable CWaitableCriticalSection cs;
+    //! Signals a new snapshot, a written one and the flush thread stopping
+    CConditionVariable condFlush;
+    //! Snapshot being written, with the arena its entries live in
+    std::unique_ptr<PoolResource> pfrozenResource;
+    CCoinsMap mapFrozen;
+    uint256 hashFrozen;
+    bool fFrozen;
+    bool fThreadRunning;
+    //! Number of snapshots handed to the flush thread
+    uint64_t nBackgroundFlushes;
+
+    //! Set once a background write failed; reported by every later write
+    bool fWriteFailed;
+
+    void WriteFrozen();
+
+public:
+    explicit CCoinsViewBackgroundFlush(CCoinsViewDB *pdbIn);
+    //! The flush thread must have been interrupted before
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    //! Iterates the database only; call Sync() first
+    CCoinsViewCursor *Cursor() const override;
+    size_t EstimateSize() const override;
+
+    //! Wait until the snapshot in flight (if any) is on disk. Returns false if a background write failed.
+    bool Sync();
+
+    //! Writes snapshots until interrupted, after writing the one in flight
+    void ThreadFlush();
+    //! Wait until ThreadFlush() runs, after which flushes are written in the background
+    void WaitForThread();
+    uint64_t GetBackgroundFlushCount() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -112,7 +186,7 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbopts = CDBOptions());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -124,21 +198,10 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
-    bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
-    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
-    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
-    bool ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
-    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool ReadAddressIndex(uint160 addressHash, int type,
-                          std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                          int start = 0, int end = 0);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
-    bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** Load all block index entries, reading them with up to nThreads threads */
+    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex, int nThreads = 1);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -16,7 +16,9 @@
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "indexdb.h"
 #include "init.h"
+#include "memusage.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "primitives/block.h"
@@ -43,6 +45,7 @@
 #include "masternode-payments.h"
 
 #include <atomic>
+#include <unordered_set>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -63,7 +66,11 @@
 
 CCriticalSection cs_main;
 
-BlockMap mapBlockIndex;
+namespace {
+    PoolResource blockIndexMapResource;
+    CBlockIndexArena blockIndexArena;
+}
+BlockMap mapBlockIndex(0, BlockHasher(), std::equal_to<uint256>(), BlockMap::allocator_type(&blockIndexMapResource));
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 CWaitableCriticalSection csBestBlock;
@@ -219,6 +226,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewBackgroundFlush *pcoinsflushview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
@@ -1092,7 +1100,7 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::v
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
 
-    if (!pblocktree->ReadTimestampIndex(high, low, hashes))
+    if (!pindexdb->ReadTimestampIndex(high, low, hashes))
         return error("Unable to get hashes for timestamps");
 
     return true;
@@ -1106,7 +1114,7 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (mempool.getSpentIndex(key, value))
         return true;
 
-    if (!pblocktree->ReadSpentIndex(key, value))
+    if (!pindexdb->ReadSpentIndex(key, value))
         return false;
 
     return true;
@@ -1118,24 +1126,52 @@ bool GetAddressIndex(uint160 addressHash, int type,
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pindexdb->ReadAddressIndex(addressHash, type, addressIndex, start, end))
         return error("unable to get txids for address");
 
     return true;
 }
 
+CAddressIndexCursor* GetAddressIndexCursor(uint160 addressHash, int type)
+{
+    if (!fAddressIndex)
+        return NULL;
+
+    return pindexdb->AddressIndexCursor(addressHash, type);
+}
+
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    // Addresses without any history have no balance record
+    if (!pindexdb->ReadAddressBalance(addressHash, type, value))
+        value.SetNull();
+
+    return true;
+}
+
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!pindexdb->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
 
     return true;
 }
 
+CAddressUnspentCursor* GetAddressUnspentCursor(uint160 addressHash, int type)
+{
+    if (!fAddressIndex)
+        return NULL;
+
+    return pindexdb->AddressUnspentCursor(addressHash, type);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1226,37 +1262,128 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/**
+ * Reads the block stored at pos. Positions we did not record ourselves get
+ * the full proof-of-work check on the header (a Lyra2REv2 hash). Positions
+ * taken from the block index (fTrusted) instead check the record marker that
+ * WriteBlockToDisk put in front of the block: the network magic and a size
+ * that must match the number of bytes deserialized.
+ */
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fTrusted)
 {
     block.SetNull();
 
+    CDiskBlockPos posRead = pos;
+    if (fTrusted) {
+        if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+            return error("ReadBlockFromDisk: No record marker in front of %s", pos.ToString());
+        posRead.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+    }
+
     // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CAutoFile filein(OpenBlockFile(posRead, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
     // Read block
     try {
-        filein >> block;
+        if (fTrusted) {
+            CMessageHeader::MessageStartChars pchMessageStart;
+            unsigned int nSize;
+            filein >> FLATDATA(pchMessageStart) >> nSize;
+            if (memcmp(pchMessageStart, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0)
+                return error("ReadBlockFromDisk: Bad record marker at %s", pos.ToString());
+            filein >> block;
+            long nEndPos = ftell(filein.Get());
+            if (nEndPos < 0 || (uint64_t)nEndPos != (uint64_t)pos.nPos + nSize)
+                return error("ReadBlockFromDisk: Block size doesn't match record marker at %s", pos.ToString());
+        } else {
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
+    if (!fTrusted && !CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    return ReadBlockFromDisk(block, pos, consensusParams, false);
+}
+
+/**
+ * The header's proof of work was checked before it entered the index, and
+ * a header with the same fields as the index entry has the same hash, so
+ * there is no need to hash it again.
+ */
+static bool HeaderMatchesIndex(const CBlockHeader& header, const CBlockIndex* pindex)
+{
+    const uint256 hashPrev = pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+    return header.nVersion == pindex->nVersion && header.hashPrevBlock == hashPrev &&
+        header.hashMerkleRoot == pindex->hashMerkleRoot && header.nTime == pindex->nTime &&
+        header.nBits == pindex->nBits && header.nNonce == pindex->nNonce;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, true))
         return false;
-    if (block.GetHash() != pindex->GetBlockHash())
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+    if (!HeaderMatchesIndex(block, pindex))
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): block header doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    block.SetCachedHash(pindex->GetBlockHash());
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vBlock, const CBlockIndex* pindex)
+{
+    static const unsigned int nHeaderSize = 80; // serialized CBlockHeader
+
+    vBlock.clear();
+
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk: No record marker in front of %s", pos.ToString());
+    CDiskBlockPos posRead = pos;
+    posRead.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(posRead, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars pchMessageStart;
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0)
+            return error("ReadRawBlockFromDisk: Bad record marker at %s", pos.ToString());
+        if (nSize < nHeaderSize || nSize > MAX_SIZE)
+            return error("ReadRawBlockFromDisk: Bad block size %u in record marker at %s", nSize, pos.ToString());
+        vBlock.resize(nSize);
+        filein.read((char*)vBlock.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // The record marker only vouches for the size, make sure these are the
+    // bytes of the block we were asked for
+    CBlockHeader header;
+    try {
+        CDataStream((const char*)vBlock.data(), (const char*)vBlock.data() + nHeaderSize, SER_DISK, CLIENT_VERSION) >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (!HeaderMatchesIndex(header, pindex))
+        return error("ReadRawBlockFromDisk: block header doesn't match index for %s at %s",
+                pindex->ToString(), pos.ToString());
     return true;
 }
 
@@ -1638,6 +1765,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1664,8 +1793,7 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-/** Abort with a message */
-bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
+bool AbortNode(const std::string& strMessage, const std::string& userMessage)
 {
     SetMiscWarning(strMessage);
     LogPrintf("*** %s\n", strMessage);
@@ -1676,9 +1804,11 @@ bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
     return false;
 }
 
+namespace {
+
 bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
 {
-    AbortNode(strMessage, userMessage);
+    ::AbortNode(strMessage, userMessage);
     return state.Error(strMessage);
 }
 
@@ -1745,51 +1875,12 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
         return DISCONNECT_FAILED;
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
-
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = *(block.vtx[i]);
         uint256 hash = tx.GetHash();
         bool is_coinbase = tx.IsCoinBase();
 
-        if (fAddressIndex) {
-
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-
-                if (out.scriptPubKey.IsPayToScriptHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-
-                    // undo receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(2, uint160(hashBytes), hash, k), CAddressUnspentValue()));
-
-                } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-
-                    // undo receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, uint160(hashBytes), hash, k), CAddressUnspentValue()));
-
-                } else if (out.scriptPubKey.IsPayToPublicKey()) {
-                    uint160 hashBytes(Hash160(out.scriptPubKey.begin()+1, out.scriptPubKey.end()-1));
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, hash, k, false), out.nValue));
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, hashBytes, hash, k), CAddressUnspentValue()));
-                } else {
-                    continue;
-                }
-
-            }
-
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         for (size_t o = 0; o < tx.vout.size(); o++) {
@@ -1812,49 +1903,9 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
             }
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                int undoHeight = txundo.vprevout[j].nHeight;
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
-
-                const CTxIn input = tx.vin[j];
-
-                if (fSpentIndex) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
-                }
-
-                if (fAddressIndex) {
-                    const Coin &coin = view.AccessCoin(tx.vin[j].prevout);
-                    const CTxOut &prevout = coin.out;
-                    if (prevout.scriptPubKey.IsPayToScriptHash()) {
-                        std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22);
-
-                        // undo spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(2, uint160(hashBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undoHeight)));
-
-
-                    } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-                        std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23);
-
-                        // undo spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, uint160(hashBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undoHeight)));
-
-                    } else if (prevout.scriptPubKey.IsPayToPublicKey()) {
-                        uint160 hashBytes(Hash160(prevout.scriptPubKey.begin()+1, prevout.scriptPubKey.end()-1));
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, hash, j, false), prevout.nValue));
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, hashBytes, hash, j), CAddressUnspentValue()));
-                    } else {
-                        continue;
-                    }
-                }
-
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -1864,17 +1915,6 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
-    if (fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            AbortNode(state, "Failed to delete address index");
-            return DISCONNECT_FAILED;
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            AbortNode(state, "Failed to write address unspent index");
-            return DISCONNECT_FAILED;
-        }
-    }
-
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -1910,6 +1950,239 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Closure representing the proof-of-work check of one block header.
+ * Hashing the header fills its hash cache, so the serial header acceptance
+ * that follows only has to compare the cached hash against the target.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+    const Consensus::Params *pparams;
+
+public:
+    CHeaderCheck(): pheader(NULL), pparams(NULL) {}
+    CHeaderCheck(const CBlockHeader& header, const Consensus::Params& params) : pheader(&header), pparams(&params) {}
+
+    bool operator()() {
+        return CheckProofOfWork(pheader->GetHash(), pheader->nBits, *pparams);
+    }
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(16);
+
+void ThreadHeaderCheck() {
+    RenameThread("bastoji-headerch");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Closure representing the database read of one coin spent by a block.
+ * Read errors are not handled here; the outpoint is simply left out of the
+ * prefetch and the serial connect reads it again through the error catcher.
+ */
+class CCoinPrefetch
+{
+private:
+    const CCoinsView *pview;
+    COutPoint outpoint;
+    Coin *pcoin;
+
+public:
+    CCoinPrefetch(): pview(NULL), pcoin(NULL) {}
+    CCoinPrefetch(const CCoinsView& view, const COutPoint& outpointIn, Coin& coinOut) : pview(&view), outpoint(outpointIn), pcoin(&coinOut) {}
+
+    bool operator()() {
+        try {
+            if (!pview->GetCoin(outpoint, *pcoin))
+                pcoin->Clear();
+        } catch (const std::runtime_error&) {
+            pcoin->Clear();
+        }
+        return true;
+    }
+
+    void swap(CCoinPrefetch &check) {
+        std::swap(pview, check.pview);
+        std::swap(outpoint, check.outpoint);
+        std::swap(pcoin, check.pcoin);
+    }
+};
+
+static CCheckQueue<CCoinPrefetch> prefetchqueue(8);
+
+void ThreadCoinPrefetch() {
+    RenameThread("bastoji-prefetch");
+    prefetchqueue.Thread();
+}
+
+/**
+ * Warm pcoinsTip with the coins spent by a block, reading the ones it does not
+ * have yet from the coins database (through pcoinsflushview, which may still
+ * hold a snapshot that is being written) in parallel. Outputs created within the
+ * block itself are skipped. Returns the number of outpoints looked up.
+ */
+static unsigned int PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads || !pcoinsTip || !pcoinsflushview || block.vtx.size() <= 1)
+        return 0;
+
+    std::unordered_set<uint256, BlockHasher> setBlockTxids;
+    for (const auto& tx : block.vtx)
+        setBlockTxids.insert(tx->GetHash());
+
+    std::vector<COutPoint> vOutpoints;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (setBlockTxids.count(txin.prevout.hash) || pcoinsTip->HaveCoinInCache(txin.prevout))
+                continue;
+            vOutpoints.push_back(txin.prevout);
+        }
+    }
+    if (vOutpoints.empty())
+        return 0;
+
+    std::vector<Coin> vCoins(vOutpoints.size());
+    {
+        std::vector<CCoinPrefetch> vChecks;
+        vChecks.reserve(vOutpoints.size());
+        for (size_t i = 0; i < vOutpoints.size(); i++)
+            vChecks.push_back(CCoinPrefetch(*pcoinsflushview, vOutpoints[i], vCoins[i]));
+        CCheckQueueControl<CCoinPrefetch> control(&prefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        if (!vCoins[i].IsSpent())
+            pcoinsTip->CacheBaseCoin(vOutpoints[i], std::move(vCoins[i]));
+    }
+    return vOutpoints.size();
+}
+
+unsigned int PreverifyTransactionBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, bool* pfScriptFailed)
+{
+    if (pfScriptFailed)
+        *pfScriptFailed = false;
+    if (!nScriptCheckThreads || vtx.empty())
+        return 0;
+
+    // Transactions that get through the checks AcceptToMemoryPool makes before
+    // their scripts, with the outputs they spend
+    std::vector<std::pair<const CTransaction*, std::vector<CTxOut> > > vChecked;
+    {
+        LOCK2(cs_main, pool.cs);
+        if (!pcoinsTip || !pcoinsflushview)
+            return 0;
+        CFeeRate mempoolMinFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        std::map<uint256, const CTransaction*> mapBatchTx;
+        for (const CTransactionRef& ptx : vtx) {
+            const CTransaction& tx = *ptx;
+            CValidationState state;
+            std::string reason;
+            if (tx.IsCoinBase() || !CheckTransaction(tx, state) || (fRequireStandard && !IsStandardTx(tx, reason)) ||
+                !CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS) || pool.exists(tx.GetHash()))
+                continue;
+
+            // AcceptToMemoryPool rejects a conflict with the memory pool
+            // (txn-mempool-conflict) before it checks any script
+            bool fConflict = false;
+            for (const CTxIn& txin : tx.vin) {
+                if (pool.mapNextTx.count(txin.prevout)) {
+                    fConflict = true;
+                    break;
+                }
+            }
+            if (fConflict)
+                continue;
+
+            // Inputs are resolved from earlier transactions of the batch, the
+            // memory pool and the coins cache, in that order. Coins that are not
+            // cached are read from the database without caching them, so that a
+            // batch of transactions which are rejected later leaves no trace.
+            std::vector<CTxOut> vSpent;
+            vSpent.reserve(tx.vin.size());
+            for (const CTxIn& txin : tx.vin) {
+                const COutPoint& prevout = txin.prevout;
+                const CTxOut* pout = NULL;
+                Coin coin;
+                auto itBatch = mapBatchTx.find(prevout.hash);
+                CTransactionRef ptxPrev;
+                if (itBatch != mapBatchTx.end()) {
+                    if (prevout.n < itBatch->second->vout.size())
+                        pout = &itBatch->second->vout[prevout.n];
+                } else if ((ptxPrev = pool.get(prevout.hash))) {
+                    if (prevout.n < ptxPrev->vout.size())
+                        pout = &ptxPrev->vout[prevout.n];
+                } else if (pcoinsTip->HaveCoinInCache(prevout)) {
+                    const Coin& coinCached = pcoinsTip->AccessCoin(prevout);
+                    if (!coinCached.IsSpent())
+                        pout = &coinCached.out;
+                } else {
+                    try {
+                        if (pcoinsflushview->GetCoin(prevout, coin) && !coin.IsSpent())
+                            pout = &coin.out;
+                    } catch (const std::runtime_error&) {}
+                }
+                if (!pout)
+                    break;
+                vSpent.push_back(*pout);
+            }
+            mapBatchTx.emplace(tx.GetHash(), &tx);
+            if (vSpent.size() != tx.vin.size())
+                continue;
+
+            // Sigops and fees, the way AcceptToMemoryPool counts them. Free
+            // transactions are left to its rate limiter.
+            unsigned int nSigOps = GetLegacySigOpCount(tx);
+            CAmount nValueIn = 0;
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                if (vSpent[i].scriptPubKey.IsPayToScriptHash())
+                    nSigOps += vSpent[i].scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig);
+                nValueIn += vSpent[i].nValue;
+            }
+            unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            CAmount nModifiedFees = nValueIn - tx.GetValueOut();
+            double nPriorityDummy = 0;
+            pool.ApplyDeltas(tx.GetHash(), nPriorityDummy, nModifiedFees);
+            if (nSigOps > MAX_STANDARD_TX_SIGOPS || (nBytesPerSigOp && nSigOps > nSize / nBytesPerSigOp) ||
+                nModifiedFees < ::minRelayTxFee.GetFee(nSize) || nModifiedFees < mempoolMinFee.GetFee(nSize))
+                continue;
+
+            vChecked.emplace_back(&tx, std::move(vSpent));
+        }
+    }
+
+    // The scripts are checked on the script check threads without cs_main;
+    // the transactions stay alive in vtx and the spent outputs are copies.
+    // Only the signature cache is of interest, a failing check just ends the
+    // round early and AcceptToMemoryPool judges the transaction as usual.
+    std::vector<CScriptCheck> vChecks;
+    for (const auto& checked : vChecked) {
+        for (unsigned int i = 0; i < checked.second.size(); i++)
+            vChecks.push_back(CScriptCheck(checked.second[i].scriptPubKey, checked.second[i].nValue, *checked.first, i, STANDARD_SCRIPT_VERIFY_FLAGS, true));
+    }
+    unsigned int nInputs = vChecks.size();
+    if (nInputs == 0)
+        return 0;
+
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    bool fAllOk = control.Wait();
+    if (pfScriptFailed)
+        *pfScriptFailed = !fAllOk;
+    return nInputs;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1985,6 +2258,7 @@ static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2124,6 +2398,14 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
+    // Pull the coins this block spends into the cache with parallel reads,
+    // the serial loop below would otherwise wait for every miss in turn.
+    // Not for blocks that are only checked (block templates), their coins
+    // would stay in pcoinsTip without the block ever being connected.
+    unsigned int nPrefetched = fJustCheck ? 0 : PrefetchBlockInputs(block);
+    int64_t nTime3 = GetTimeMicros(); nTimePrefetch += nTime3 - nTime2;
+    LogPrint("bench", "    - Prefetch %u inputs: %.2fms [%.2fs]\n", nPrefetched, 0.001 * (nTime3 - nTime2), nTimePrefetch * 0.000001);
+
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
@@ -2136,16 +2418,12 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
 
     bool fDIP0001Active_context = pindex->nHeight >= Params().GetConsensus().DIP0001Height;
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
-        const uint256 txhash = tx.GetHash();
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2172,46 +2450,6 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
 
-            if (fAddressIndex || fSpentIndex)
-            {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-                    const CTxIn input = tx.vin[j];
-                    const Coin& coin = view.AccessCoin(tx.vin[j].prevout);
-                    const CTxOut &prevout = coin.out;
-                    uint160 hashBytes;
-                    int addressType;
-
-                    if (prevout.scriptPubKey.IsPayToScriptHash()) {
-                        hashBytes = uint160(std::vector<unsigned char>(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22));
-                        addressType = 2;
-                    } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-                        hashBytes = uint160(std::vector<unsigned char>(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23));
-                        addressType = 1;
-                    } else if (prevout.scriptPubKey.IsPayToPublicKey()) {
-                        hashBytes = Hash160(prevout.scriptPubKey.begin()+1, prevout.scriptPubKey.end()-1);
-                        addressType = 1;
-                    } else {
-                        hashBytes.SetNull();
-                        addressType = 0;
-                    }
-
-                    if (fAddressIndex && addressType > 0) {
-                        // record spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
-
-                        // remove address from unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
-                    }
-
-                    if (fSpentIndex) {
-                        // add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input
-                        spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, hashBytes)));
-                    }
-                }
-
-            }
-
             if (fStrictPayToScriptHash)
             {
                 // Add in sigops done by pay-to-script-hash inputs;
@@ -2233,39 +2471,6 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
             control.Add(vChecks);
         }
 
-        if (fAddressIndex) {
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-
-                if (out.scriptPubKey.IsPayToScriptHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-
-                    // record receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, txhash, k, false), out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(2, uint160(hashBytes), txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-
-                } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                    std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-
-                    // record receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, txhash, k, false), out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, uint160(hashBytes), txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-
-                } else if (out.scriptPubKey.IsPayToPublicKey()) {
-                    uint160 hashBytes(Hash160(out.scriptPubKey.begin()+1, out.scriptPubKey.end()-1));
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                } else {
-                    continue;
-                }
-
-            }
-        }
-
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2275,8 +2480,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
-    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
+    int64_t nTime4 = GetTimeMicros(); nTimeConnect += nTime4 - nTime3;
+    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime4 - nTime3), 0.001 * (nTime4 - nTime3) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime3) / (nInputs-1), nTimeConnect * 0.000001);
 
     // BTJ : MODIFIED TO CHECK MASTERNODE PAYMENTS AND SUPERBLOCKS
 
@@ -2301,8 +2506,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
 
     if (!control.Wait())
         return state.DoS(100, false);
-    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
-    LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
+    int64_t nTime5 = GetTimeMicros(); nTimeVerify += nTime5 - nTime3;
+    LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime5 - nTime3), nInputs <= 1 ? 0 : 0.001 * (nTime5 - nTime3) / (nInputs-1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
         return true;
@@ -2330,29 +2535,11 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-
-    if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
-
-    if (fTimestampIndex)
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
-    int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
-    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
+    int64_t nTime6 = GetTimeMicros(); nTimeIndex += nTime6 - nTime5;
+    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
@@ -2360,8 +2547,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
 
-    int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
-    LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
+    int64_t nTime7 = GetTimeMicros(); nTimeCallbacks += nTime7 - nTime6;
+    LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime7 - nTime6), nTimeCallbacks * 0.000001);
 
     return true;
 }
@@ -2461,8 +2648,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
         if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // With -backgroundflush this only hands the changes to a writer thread,
+        // unless the caller asked for everything to be on disk.
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        if (mode == FLUSH_STATE_ALWAYS && !pcoinsflushview->Sync())
+            return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -3092,8 +3283,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3282,7 +3472,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
         return false;
 
     // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    if (fCheckMerkleRoot && !block.fMerkleRootChecked) {
         bool mutated;
         uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -3518,6 +3708,21 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
+    // Lyra2REv2 makes hashing the headers the bulk of the work, so hash and
+    // check the whole batch in parallel before taking cs_main. A failure is
+    // not acted upon here: the serial pass below stops at the same header with
+    // the usual state, after accepting the headers in front of it.
+    if (nScriptCheckThreads && headers.size() > 1) {
+        std::vector<CHeaderCheck> vChecks;
+        vChecks.reserve(headers.size());
+        for (const CBlockHeader& header : headers)
+            vChecks.push_back(CHeaderCheck(header, chainparams.GetConsensus()));
+        CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+        control.Add(vChecks);
+        if (!control.Wait())
+            LogPrint("net", "%s: batch of %u headers has an invalid proof of work\n", __func__, headers.size());
+    }
+
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
@@ -3865,34 +4070,43 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw std::runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+BlockIndexMemoryStats GetBlockIndexMemoryStats()
+{
+    LOCK(cs_main);
+    BlockIndexMemoryStats stats;
+    stats.nEntries = blockIndexArena.Size();
+    stats.nArenaBytes = blockIndexArena.DynamicMemoryUsage();
+    stats.nMapBytes = blockIndexMapResource.NumChunks() * memusage::MallocUsage(PoolResource::CHUNK_SIZE_BYTES) + blockIndexMapResource.LargeBytes();
+    stats.nHeapBytes = stats.nEntries * memusage::MallocUsage(sizeof(CBlockIndex)) +
+        memusage::MallocUsage(sizeof(memusage::unordered_node<BlockMap::value_type>)) * mapBlockIndex.size() +
+        memusage::MallocUsage(sizeof(void*) * mapBlockIndex.bucket_count());
+    return stats;
+}
+
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+    int nLoadThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, nLoadThreads))
         return false;
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
+    // Calculate nChainWork. Parents have to come before their children.
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CBlockIndex*> vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight.push_back(item.second);
+    vSortedByHeight = SortByHeight(vSortedByHeight, [](const CBlockIndex* pindex) { return pindex->nHeight; });
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
@@ -3918,6 +4132,8 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: computed chain work of %u block index entries in %.2fms\n", __func__,
+        vSortedByHeight.size(), (GetTimeMicros() - nTimeStart) * 0.001);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4123,10 +4339,8 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
 }
 
@@ -4203,6 +4417,186 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+namespace {
+
+/** Max number of blocks read ahead of the validation thread by LoadExternalBlockFile */
+static const size_t MAX_IMPORT_BLOCKS_AHEAD = 32;
+/** Max number of threads computing block hashes for LoadExternalBlockFile */
+static const int MAX_IMPORT_HASH_THREADS = 8;
+
+/**
+ * Pipeline feeding LoadExternalBlockFile. One thread scans the file for the
+ * message start and deserializes the blocks, a few threads compute their
+ * header hashes and merkle roots, and the caller takes the blocks in file
+ * order through Next(), so validation overlaps with reading and hashing.
+ */
+class CBlockImportPipeline
+{
+private:
+    struct Entry {
+        std::shared_ptr<CBlock> pblock;
+        unsigned int nPos;
+        bool fHashed;
+    };
+
+    const CChainParams& chainparams;
+    CBufferedFile blkdat;
+
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    //! Blocks read and not taken yet, in file order
+    std::deque<std::shared_ptr<Entry> > queueRead;
+    //! Blocks read and not claimed by a hash thread yet
+    std::deque<std::shared_ptr<Entry> > queueHash;
+    bool fReadDone;
+    bool fStop;
+    std::string strError;
+    boost::thread_group threads;
+
+    void ThreadRead()
+    {
+        try {
+            uint64_t nRewind = blkdat.GetPos();
+            while (!blkdat.eof()) {
+                {
+                    boost::unique_lock<boost::mutex> lock(cs);
+                    if (fStop)
+                        break;
+                }
+
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                    blkdat.FindByte(chainparams.MessageStart()[0]);
+                    nRewind = blkdat.GetPos()+1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MaxBlockSize(true))
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    break;
+                }
+                try {
+                    // read block
+                    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+                    entry->nPos = blkdat.GetPos();
+                    entry->fHashed = false;
+                    blkdat.SetLimit(entry->nPos + nSize);
+                    blkdat.SetPos(entry->nPos);
+                    entry->pblock = std::make_shared<CBlock>();
+                    blkdat >> *entry->pblock;
+                    nRewind = blkdat.GetPos();
+
+                    boost::unique_lock<boost::mutex> lock(cs);
+                    while (!fStop && queueRead.size() >= MAX_IMPORT_BLOCKS_AHEAD)
+                        cond.wait(lock);
+                    if (fStop)
+                        break;
+                    queueRead.push_back(entry);
+                    queueHash.push_back(entry);
+                    cond.notify_all();
+                } catch (const std::exception& e) {
+                    LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", e.what());
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            boost::unique_lock<boost::mutex> lock(cs);
+            strError = e.what();
+        }
+        boost::unique_lock<boost::mutex> lock(cs);
+        fReadDone = true;
+        cond.notify_all();
+    }
+
+    void ThreadHash()
+    {
+        while (true) {
+            std::shared_ptr<Entry> entry;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && !fReadDone && queueHash.empty())
+                    cond.wait(lock);
+                if (fStop || queueHash.empty())
+                    return;
+                entry = queueHash.front();
+                queueHash.pop_front();
+            }
+
+            // Fill the hash cache of the header and do the merkle root part
+            // of CheckBlock; a mismatch is left for CheckBlock to report
+            const CBlock& block = *entry->pblock;
+            block.GetHash();
+            bool mutated;
+            if (BlockMerkleRoot(block, &mutated) == block.hashMerkleRoot && !mutated)
+                block.fMerkleRootChecked = true;
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            entry->fHashed = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    /** Takes over fileIn and calls fclose() on it when done */
+    CBlockImportPipeline(const CChainParams& chainparamsIn, FILE* fileIn) :
+        chainparams(chainparamsIn),
+        blkdat(fileIn, 2*MaxBlockSize(true), MaxBlockSize(true)+8, SER_DISK, CLIENT_VERSION),
+        fReadDone(false), fStop(false)
+    {
+        int nHashThreads = std::max(1, std::min(GetNumCores() - 1, MAX_IMPORT_HASH_THREADS));
+        threads.create_thread([this] { ThreadRead(); });
+        for (int i = 0; i < nHashThreads; i++)
+            threads.create_thread([this] { ThreadHash(); });
+    }
+
+    ~CBlockImportPipeline()
+    {
+        boost::this_thread::disable_interruption di;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        threads.join_all();
+    }
+
+    /**
+     * Wait for the next block of the file and its position in it. Returns
+     * false once the file is exhausted; GetError() then tells whether reading
+     * it failed.
+     */
+    bool Next(std::shared_ptr<CBlock>& pblock, unsigned int& nPos)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (queueRead.empty() || !queueRead.front()->fHashed) {
+            if (queueRead.empty() && fReadDone)
+                return false;
+            cond.wait(lock);
+        }
+        pblock = queueRead.front()->pblock;
+        nPos = queueRead.front()->nPos;
+        queueRead.pop_front();
+        cond.notify_all();
+        return true;
+    }
+
+    std::string GetError()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return strError;
+    }
+};
+
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4211,44 +4605,17 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
     int nLoaded = 0;
     try {
-        unsigned int nMaxBlockSize = MaxBlockSize(true);
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*nMaxBlockSize, nMaxBlockSize+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // This takes over fileIn and calls fclose() on it when done
+        CBlockImportPipeline pipeline(chainparams, fileIn);
+        std::shared_ptr<CBlock> pblock;
+        unsigned int nBlockPos = 0;
+        while (pipeline.Next(pblock, nBlockPos)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > nMaxBlockSize)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -4313,6 +4680,8 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
+        if (!pipeline.GetError().empty())
+            throw std::runtime_error(pipeline.GetError());
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -4527,6 +4896,8 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
 }
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Number of mempool.dat entries whose scripts are verified together at startup */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 256;
 
 bool LoadMempool(void)
 {
@@ -4552,29 +4923,42 @@ bool LoadMempool(void)
         uint64_t num;
         file >> num;
         double prioritydummy = 0;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), prioritydummy, amountdelta);
+        while (num) {
+            // Read a batch of entries, verify their scripts in parallel and
+            // then accept them in file order.
+            std::vector<CTransactionRef> vtx;
+            std::vector<int64_t> vTime;
+            while (num && vtx.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                CTransactionRef tx;
+                int64_t nTime;
+                int64_t nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> nFeeDelta;
+                num--;
+
+                CAmount amountdelta = nFeeDelta;
+                if (amountdelta) {
+                    mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), prioritydummy, amountdelta);
+                }
+                if (nTime + nExpiryTimeout > nNow) {
+                    vtx.push_back(tx);
+                    vTime.push_back(nTime);
+                } else {
+                    ++skipped;
+                }
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
+
+            PreverifyTransactionBatch(mempool, vtx);
+            LOCK(cs_main);
+            for (size_t i = 0; i < vtx.size(); i++) {
+                CValidationState state;
+                AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i]);
                 if (state.IsValid()) {
                     ++count;
                 } else {
                     ++failed;
                 }
-            } else {
-                ++skipped;
             }
             if (ShutdownRequested())
                 return false;
@@ -4664,10 +5048,8 @@ class CMainCleanup
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, which live in the arena and are not freed one by one
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
     }
 } instance_of_cmaincleanup;
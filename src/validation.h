@@ -16,6 +16,7 @@
 #include "coins.h"
 #include "protocol.h" // For CMessageHeader::MessageStartChars
 #include "script/script_error.h"
+#include "support/allocators/pool.h"
 #include "sync.h"
 #include "versionbits.h"
 #include "spentindex.h"
@@ -36,11 +37,15 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewBackgroundFlush;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
+class CAddressIndexCursor;
+class CAddressUnspentCursor;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
@@ -84,6 +89,10 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of header proof-of-work checking threads besides the caller, a pool of its own next to the -par threads */
+static const int MAX_HEADERCHECK_THREADS = 4;
+/** Maximum number of threads reading block inputs from the coins database besides the caller, also a pool of its own */
+static const int MAX_PREFETCH_THREADS = 4;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -157,7 +166,12 @@ struct BlockHasher
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+/**
+ * Map of all known block index entries. Nodes are allocated from a
+ * PoolResource and the entries themselves from a CBlockIndexArena, both owned
+ * by validation.cpp. The key stays the full hash: phashBlock points into it.
+ */
+typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher, std::equal_to<uint256>, PoolAllocator<std::pair<const uint256, CBlockIndex*> > > BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
@@ -168,6 +182,9 @@ extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fTimestampIndex;
+extern bool fSpentIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
@@ -257,6 +274,8 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationS
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
+/** Abort with a message: warn, tell the user and shut down */
+bool AbortNode(const std::string& strMessage, const std::string& userMessage = "");
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
@@ -273,6 +292,10 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the thread reading block inputs from the coins database */
+void ThreadCoinPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -324,6 +347,19 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
+
+/** Memory used by the block index, as reported by getmemoryinfo */
+struct BlockIndexMemoryStats
+{
+    size_t nEntries;
+    //! Bytes of the CBlockIndex arena
+    size_t nArenaBytes;
+    //! Bytes of the mapBlockIndex nodes and buckets
+    size_t nMapBytes;
+    //! Estimate of the bytes the same entries take with one heap allocation per entry and per node
+    size_t nHeapBytes;
+};
+BlockIndexMemoryStats GetBlockIndexMemoryStats();
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
@@ -337,6 +373,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced = NULL, bool fOverrideMempoolLimit=false,
                         const CAmount nAbsurdFee=0, bool fDryRun=false);
 
+/**
+ * Verify the scripts of a batch of transactions in parallel before they are
+ * offered to the memory pool one at a time. Valid signatures are stored in the
+ * signature cache, so the serial AcceptToMemoryPool calls that follow mostly
+ * hit it; nothing is added to the pool here. Only transactions that pass the
+ * checks AcceptToMemoryPool makes before their scripts (standardness,
+ * finality, sigops and fees) and whose inputs can be found, also among
+ * earlier transactions of the batch, are checked. The checks run on the
+ * script check threads. cs_main is held while the inputs are looked up, not
+ * while the scripts run, so the caller must not hold it. Whether a
+ * transaction is valid is still only decided by AcceptToMemoryPool.
+ * Returns the number of inputs queued for checking. pfScriptFailed, if
+ * given, is set to whether one of the checks failed.
+ */
+unsigned int PreverifyTransactionBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, bool* pfScriptFailed = NULL);
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
@@ -477,13 +529,20 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(uint160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                      int start = 0, int end = 0);
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+/** Cursors over the address index of one address, or NULL if the index is disabled */
+CAddressIndexCursor* GetAddressIndexCursor(uint160 addressHash, int type);
+CAddressUnspentCursor* GetAddressUnspentCursor(uint160 addressHash, int type);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block of pindex as stored, for sending it to peers without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vBlock, const CBlockIndex* pindex);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -530,6 +589,9 @@ extern CChain chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern CCoinsViewDB *pcoinsdbview;
 
+/** Global variable that points to the view writing pcoinsTip's flushes to pcoinsdbview (protected by cs_main) */
+extern CCoinsViewBackgroundFlush *pcoinsflushview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 